@@ -5,11 +5,14 @@
 #include <string>
 #include <iostream>
 #include <random>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
 
-Node::Node(int value) : key(value), height(1), left(nullptr), right(nullptr), x(0), y(0), targetX(0), targetY(0), isDying(false) {}
-
-AVLTree::AVLTree() : root(nullptr), instantMode(false), currentOperation("") {
+AVLTree::AVLTree() : core(std::less<int>(), std::allocator<int>(), VisualHooks{ this }), layoutValid(false), contourGarbage(0), contourGeneration(1), highlightGeneration(1), historyBudget(DEFAULT_HISTORY_BUDGET), historyBytes(0), settleTimer(0.0f), sharedReads(false), instantMode(false), currentOperation("") {
     instantBtn = { 900, 880, 100, 40 };
+    relaxedBtn = { 1010, 880, 100, 40 };
     insertCode = {
         "insert(node, key):",
         "  if node is null:",
@@ -48,389 +51,619 @@ AVLTree::AVLTree() : root(nullptr), instantMode(false), currentOperation("") {
 }
 
 AVLTree::~AVLTree() {
-    deleteTree(root);
-    clearHistory();
+    // The core's pool frees every version's nodes with its slabs
 }
 
-void AVLTree::deleteTree(Node* node) {
-    if (!node) return;
-    deleteTree(node->left);
-    deleteTree(node->right);
-    delete node;
+void VisualHooks::created(int node, int copiedFrom) {
+    tree->visualCreated(node, copiedFrom);
 }
 
-Node* AVLTree::deepCopy(Node* node) {
-    if (!node) return nullptr;
-    Node* newNode = new Node(node->key);
-    newNode->height = node->height;
-    newNode->x = node->x;
-    newNode->y = node->y;
-    newNode->targetX = node->targetX;
-    newNode->targetY = node->targetY;
-    newNode->isDying = node->isDying;
-    newNode->left = deepCopy(node->left);
-    newNode->right = deepCopy(node->right);
-    return newNode;
+void VisualHooks::destroyed(int node) {
+    tree->visualDestroyed(node);
 }
 
-int AVLTree::getHeight(Node* node) {
-    return node ? node->height : 0;
+// Called by the core for every new node, under its pool lock while set operations run in
+// parallel. A copy starts where the original was, but shares none of its layout or
+// highlight state.
+void AVLTree::visualCreated(int node, int copiedFrom) {
+    if (static_cast<int>(visuals.size()) < core.capacity())
+        visuals.resize(core.capacity());
+    NodeVisual visual = NodeVisual();
+    if (copiedFrom) {
+        visual.x = visuals[copiedFrom].x;
+        visual.y = visuals[copiedFrom].y;
+        visual.targetX = visuals[copiedFrom].targetX;
+        visual.targetY = visuals[copiedFrom].targetY;
+    }
+    visuals[node] = visual;
 }
 
-int AVLTree::getBalance(Node* node) {
-    return node ? getHeight(node->left) - getHeight(node->right) : 0;
+void AVLTree::visualDestroyed(int node) {
+    if (visuals[node].contourGeneration == contourGeneration) contourGarbage += 2 * visuals[node].contourLevels;
+    if (visuals[node].movingSlot) stopMoving(node);
 }
 
-void AVLTree::updateHeight(Node* node) {
-    if (node) {
-        node->height = 1 + std::max(getHeight(node->left), getHeight(node->right));
+// Lines of insertCode traced for each rebalancing case at one level of the climb
+static const int REBALANCE_TRACE[5][7] = {
+    { 11, 13, 15, 18, 21, -1 },     // Balanced
+    { 11, 12, -1 },                 // Left-left: rightRotate(node)
+    { 11, 13, 14, -1 },             // Right-right: leftRotate(node)
+    { 11, 13, 15, 16, 17, -1 },     // Left-right
+    { 11, 13, 15, 18, 19, 20, -1 }  // Right-left
+};
+
+void RecordTrace::descend(bool left) {
+    line(0); // Line: insert(node, key)
+    line(3); // Line: if key < node.key
+    if (left) {
+        line(4); // Line: node.left = insert(node.left, key)
+    }
+    else {
+        line(5); // Line: else if key > node.key
+        line(6); // Line: node.right = insert(node.right, key)
     }
 }
 
-Node* AVLTree::rightRotate(Node* y) {
-    Node* x = y->left;
-    Node* T2 = x->right;
-
-    x->right = y;
-    y->left = T2;
-
-    updateHeight(y);
-    updateHeight(x);
-
-    return x;
+void RecordTrace::create() {
+    line(0); // Line: insert(node, key)
+    line(2); // Line: return new Node(key)
 }
 
-Node* AVLTree::leftRotate(Node* x) {
-    Node* y = x->right;
-    Node* T2 = y->left;
-
-    y->left = x;
-    x->right = T2;
-
-    updateHeight(x);
-    updateHeight(y);
-
-    return y;
+void RecordTrace::climb(Rebalance rebalance) {
+    line(9); // Line: updateHeight(node)
+    line(10); // Line: balance = getBalance(node)
+    for (const int* index = REBALANCE_TRACE[static_cast<int>(rebalance)]; *index >= 0; ++index)
+        line(*index);
 }
 
-Node* AVLTree::insert(Node* node, int key, std::vector<Node*>& path, std::string& searchResult, std::vector<int>& codePath) {
-    codePath.push_back(0); // Line: insert(node, key)
-    if (!node) {
-        codePath.push_back(2); // Line: return new Node(key)
-        Node* newNode = new Node(key);
-        path.push_back(newNode);
-        return newNode;
+void AVLTree::insert(int key, std::string& searchResult) {
+    currentOperation = "insert";
+    currentCodePath.clear();
+    searchResult = "";
+    if (core.contains(key, finger)) {
+        // Checked up front so a duplicate does not copy the path for nothing
+        searchResult = "The value of node is already in tree";
+        return;
     }
-
-    path.push_back(node);
-    codePath.push_back(3); // Line: if key < node.key
-    if (key < node->key) {
-        codePath.push_back(4); // Line: node.left = insert(node.left, key)
-        node->left = insert(node->left, key, path, searchResult, codePath);
+    recordHistory(TreeOperation::INSERT, key);
+    if (instantMode) {
+        // Nobody watches the code box in instant mode
+        core.insert(key, finger);
     }
     else {
-        codePath.push_back(5); // Line: else if key > node.key
-        if (key > node->key) {
-            codePath.push_back(6); // Line: node.right = insert(node.right, key)
-            node->right = insert(node->right, key, path, searchResult, codePath);
-        }
-        else {
-            codePath.push_back(7); // Line: return node // Duplicate key
-            searchResult = "The value of node is already in tree";
-            return node;
-        }
+        RecordTrace tracer = { currentCodePath };
+        core.insert(key, tracer, finger);
     }
+    settleTimer = 0.0f;
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
+}
 
-    codePath.push_back(9); // Line: updateHeight(node)
-    updateHeight(node);
-    codePath.push_back(10); // Line: balance = getBalance(node)
-    int balance = getBalance(node);
+// Number of keys smaller than key
+int AVLTree::rank(int key, std::vector<int>& path) {
+    path.clear();
+    return core.countBelow(key, false, &path);
+}
 
-    codePath.push_back(11); // Line: if balance > 1 and key < node.left.key
-    if (balance > 1 && key < node->left->key) {
-        codePath.push_back(12); // Line: return rightRotate(node)
-        return rightRotate(node);
-    }
-    codePath.push_back(13); // Line: if balance < -1 and key > node.right.key
-    if (balance < -1 && key > node->right->key) {
-        codePath.push_back(14); // Line: return leftRotate(node)
-        return leftRotate(node);
-    }
-    codePath.push_back(15); // Line: if balance > 1 and key > node.left.key
-    if (balance > 1 && key > node->left->key) {
-        codePath.push_back(16); // Line: node.left = leftRotate(node.left)
-        node->left = leftRotate(node->left);
-        codePath.push_back(17); // Line: return rightRotate(node)
-        return rightRotate(node);
-    }
-    codePath.push_back(18); // Line: if balance < -1 and key < node.right.key
-    if (balance < -1 && key < node->right->key) {
-        codePath.push_back(19); // Line: node.right = rightRotate(node.right)
-        node->right = rightRotate(node->right);
-        codePath.push_back(20); // Line: return leftRotate(node)
-        return leftRotate(node);
-    }
+// Node holding the k-th smallest key (1-based), or 0 when k is out of range
+int AVLTree::select(int k, std::vector<int>& path) {
+    path.clear();
+    return core.select(k, &path);
+}
 
-    codePath.push_back(21); // Line: return node
-    return node;
+// Number of keys in [lo, hi]; path gets the descent to lo followed by the descent to hi
+int AVLTree::countRange(int lo, int hi, std::vector<int>& path) {
+    path.clear();
+    return core.countRange(lo, hi, &path);
 }
 
-void AVLTree::insert(int key, std::string& searchResult) {
-    Node* treeCopy = deepCopy(root);
-    std::vector<Node*> path;
-    std::vector<int> codePath;
-    currentOperation = "insert";
-    currentCodePath.clear();
-    searchResult = "";
-    root = insert(root, key, path, searchResult, codePath);
-    if (searchResult.empty()) {
-        history.push({ treeCopy, {true, key} });
-        while (!redoStack.empty()) {
-            deleteTree(redoStack.top().first);
-            redoStack.pop();
-        }
-        calculatePositions(root, GetScreenWidth() / 2, 50, 300, 1);
-    }
-    else {
-        deleteTree(treeCopy);
+void AVLTree::deleteNode(int key) {
+    if (core.contains(key)) {
+        recordHistory(TreeOperation::REMOVE, key);
+        core.erase(key);
+        publish();
+        calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
     }
-    currentCodePath = codePath;
 }
 
-Node* AVLTree::findMin(Node* node) {
-    while (node && node->left)
-        node = node->left;
-    return node;
+static bool isCheckpoint(TreeOperation operation) {
+    return operation == TreeOperation::LOAD || operation == TreeOperation::COMBINE;
 }
 
-Node* AVLTree::deleteNode(Node* node, int key) {
-    if (!node) return nullptr;
+// A key entry is a few bytes; a checkpoint is charged for every node of its version, as
+// if none were shared with the live tree
+size_t AVLTree::historyCost(const HistoryEntry& entry) {
+    size_t cost = sizeof(HistoryEntry);
+    if (isCheckpoint(entry.operation))
+        cost += static_cast<size_t>(at(entry.version).size) * (sizeof(Node) + sizeof(NodeVisual));
+    return cost;
+}
 
-    if (key < node->key)
-        node->left = deleteNode(node->left, key);
-    else if (key > node->key)
-        node->right = deleteNode(node->right, key);
-    else {
-        if (!node->left && !node->right) {
-            delete node;
-            return nullptr;
-        }
-        else if (!node->left) {
-            Node* temp = node->right;
-            delete node;
-            return temp;
-        }
-        else if (!node->right) {
-            Node* temp = node->left;
-            delete node;
-            return temp;
-        }
-        else {
-            Node* temp = findMin(node->right);
-            node->key = temp->key;
-            node->right = deleteNode(node->right, temp->key);
-        }
+void AVLTree::dropEntry(const HistoryEntry& entry) {
+    historyBytes -= historyCost(entry);
+    core.release(entry.version);
+}
+
+// Forgets the oldest undo steps, then the furthest redo steps, until the log fits its budget
+void AVLTree::trimHistory() {
+    while (historyBytes > historyBudget && !history.empty()) {
+        dropEntry(history.front());
+        history.pop_front();
     }
+    while (historyBytes > historyBudget && !redoStack.empty()) {
+        dropEntry(redoStack.front());
+        redoStack.pop_front();
+    }
+}
 
-    if (node) {
-        updateHeight(node);
-        int balance = getBalance(node);
+// Logs an operation about to be applied; a new operation invalidates everything undone before it
+void AVLTree::recordHistory(TreeOperation operation, int value) {
+    for (const HistoryEntry& entry : redoStack)
+        dropEntry(entry);
+    redoStack.clear();
+    HistoryEntry entry = { isCheckpoint(operation) ? core.snapshot() : 0, operation, value };
+    history.push_back(entry);
+    historyBytes += historyCost(entry);
+    trimHistory();
+}
 
-        if (balance > 1 && getBalance(node->left) >= 0) return rightRotate(node);
-        if (balance > 1 && getBalance(node->left) < 0) {
-            node->left = leftRotate(node->left);
-            return rightRotate(node);
-        }
-        if (balance < -1 && getBalance(node->right) <= 0) return leftRotate(node);
-        if (balance < -1 && getBalance(node->right) > 0) {
-            node->right = rightRotate(node->right);
-            return leftRotate(node);
-        }
+// Applies entry backwards (undoing) or forwards, returning what steps back the other way.
+// Key operations cost one O(log n) insert or remove; checkpoints swap roots.
+HistoryEntry AVLTree::replay(const HistoryEntry& entry, bool undoing) {
+    if (isCheckpoint(entry.operation)) {
+        HistoryEntry other = { core.exchange(entry.version), entry.operation, entry.value };
+        layoutValid = false;
+        return other;
     }
-
-    return node;
+    if ((entry.operation == TreeOperation::INSERT) != undoing)
+        core.insert(entry.value);
+    else
+        core.erase(entry.value);
+    return entry;
 }
 
-void AVLTree::deleteNode(int key) {
-    if (root) {
-        Node* treeCopy = deepCopy(root);
-        history.push({ treeCopy, {false, key} });
-        while (!redoStack.empty()) {
-            deleteTree(redoStack.top().first);
-            redoStack.pop();
-        }
+void AVLTree::shareReads() {
+    sharedReads = true;
+    core.publish();
+}
 
-        root = deleteNode(root, key);
-        calculatePositions(root, GetScreenWidth() / 2, 50, 300, 1);
-    }
+void AVLTree::setHistoryBudget(size_t bytes) {
+    historyBudget = bytes;
+    trimHistory();
 }
 
 void AVLTree::clear() {
-    deleteTree(root);
-    root = nullptr;
-    clearHistory();
+    core.clear();
+    binaryFile.close(); // No node lives in it any more
+    nodesDropped();
 }
 
-Node* AVLTree::undo(std::vector<Node*>& affectedPath) {
-    if (history.empty()) return nullptr;
-    std::pair<Node*, std::pair<bool, int>> operation = history.top();
-    Node* previousState = operation.first;
-    bool wasInsert = operation.second.first;
-    int value = operation.second.second;
-    history.pop();
+// Forgets what was kept per version and per node once the core has dropped every node
+void AVLTree::nodesDropped() {
+    history.clear();
+    redoStack.clear();
+    historyBytes = 0;
+    contourArena.clear();
+    contourGarbage = 0;
+    contourGeneration++;
+    movingNodes.clear();
+    movingX.clear();
+    movingY.clear();
+    movingTargetX.clear();
+    movingTargetY.clear();
+}
 
-    Node* currentState = deepCopy(root);
-    redoStack.push({ currentState, {wasInsert, value} });
+int AVLTree::undo(std::vector<int>& affectedPath) {
+    if (history.empty()) return 0;
+    HistoryEntry entry = history.back();
+    history.pop_back();
+    historyBytes -= historyCost(entry);
 
-    deleteTree(root);
-    root = previousState;
+    redoStack.push_back(replay(entry, true));
+    historyBytes += historyCost(redoStack.back());
+    trimHistory();
 
     affectedPath.clear();
-    search(value, affectedPath, currentCodePath);
-    calculatePositions(root, GetScreenWidth() / 2, 50, 300, 1);
-    return affectedPath.empty() ? nullptr : affectedPath.back();
+    if (entry.operation == TreeOperation::INSERT || entry.operation == TreeOperation::REMOVE) {
+        NoTrace tracer;
+        findPath(entry.value, affectedPath, tracer);
+    }
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
+    return affectedPath.empty() ? 0 : affectedPath.back();
 }
 
-Node* AVLTree::redo(std::vector<Node*>& affectedPath) {
-    if (redoStack.empty()) return nullptr;
-    std::pair<Node*, std::pair<bool, int>> operation = redoStack.top();
-    Node* redoState = operation.first;
-    bool wasInsert = operation.second.first;
-    int value = operation.second.second;
-    redoStack.pop();
+int AVLTree::redo(std::vector<int>& affectedPath) {
+    if (redoStack.empty()) return 0;
+    HistoryEntry entry = redoStack.back();
+    redoStack.pop_back();
+    historyBytes -= historyCost(entry);
 
-    Node* currentState = deepCopy(root);
-    history.push({ currentState, {wasInsert, value} });
-
-    deleteTree(root);
-    root = redoState;
+    history.push_back(replay(entry, false));
+    historyBytes += historyCost(history.back());
+    trimHistory();
 
     affectedPath.clear();
-    search(value, affectedPath, currentCodePath);
-    calculatePositions(root, GetScreenWidth() / 2, 50, 300, 1);
-    return affectedPath.empty() ? nullptr : affectedPath.back();
+    if (entry.operation == TreeOperation::INSERT || entry.operation == TreeOperation::REMOVE) {
+        NoTrace tracer;
+        findPath(entry.value, affectedPath, tracer);
+    }
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
+    return affectedPath.empty() ? 0 : affectedPath.back();
 }
 
 void AVLTree::clearHistory() {
-    while (!history.empty()) {
-        deleteTree(history.top().first);
-        history.pop();
-    }
-    while (!redoStack.empty()) {
-        deleteTree(redoStack.top().first);
-        redoStack.pop();
-    }
+    for (const HistoryEntry& entry : history)
+        core.release(entry.version);
+    history.clear();
+    for (const HistoryEntry& entry : redoStack)
+        core.release(entry.version);
+    redoStack.clear();
+    historyBytes = 0;
 }
 
-void AVLTree::search(int key, std::vector<Node*>& searchPath, std::vector<int>& codePath) {
-    searchPath.clear();
+void AVLTree::search(int key, std::vector<int>& searchPath, CodeTrace& codePath) {
     codePath.clear();
-    Node* current = root;
+    RecordTrace tracer = { codePath };
+    findPath(key, searchPath, tracer);
+}
+
+// Descent to key for highlighting; the tracer hears the searchCode lines it visits
+template <typename Tracer>
+void AVLTree::findPath(int key, std::vector<int>& searchPath, Tracer& tracer) {
+    searchPath.clear();
+    int current = core.getRoot();
     int step = 0;
     while (current && step < 100) {
         searchPath.push_back(current);
-        codePath.push_back(0); // Line: search(node, key)
-        codePath.push_back(3); // Line: if key == node.key
-        if (key == current->key) {
-            codePath.push_back(4); // Line: return found
+        tracer.line(0); // Line: search(node, key)
+        tracer.line(3); // Line: if key == node.key
+        if (key == at(current).key) {
+            tracer.line(4); // Line: return found
             break;
         }
-        codePath.push_back(5); // Line: if key < node.key
-        if (key < current->key) {
-            codePath.push_back(6); // Line: return search(node.left, key)
-            current = current->left;
+        tracer.line(5); // Line: if key < node.key
+        if (key < at(current).key) {
+            tracer.line(6); // Line: return search(node.left, key)
+            current = at(current).left;
         }
         else {
-            codePath.push_back(7); // Line: return search(node.right, key)
-            current = current->right;
+            tracer.line(7); // Line: return search(node.right, key)
+            current = at(current).right;
         }
-        codePath.push_back(1); // Line: if node is null
+        tracer.line(1); // Line: if node is null
         if (!current) {
-            codePath.push_back(2); // Line: return not found
+            tracer.line(2); // Line: return not found
             break;
         }
         step++;
     }
 }
 
-void AVLTree::calculatePositions(Node* node, int x, int y, int xOffset, int depth) {
-    if (!node) return;
+bool AVLTree::contourStale(int node) {
+    return (at(node).flags & Node::DIRTY) || visuals[node].contourGeneration != contourGeneration;
+}
+
+// Reingold-Tilford step for one node: push the two child subtrees apart until their
+// contours are NODE_SEPARATION apart on every level they share, then merge the contours.
+// Costs O(height), and AVL heights over all nodes sum to O(n).
+void AVLTree::computeContour(int node) {
+    const Node& n = at(node);
+    NodeVisual& visual = visuals[node];
+    int levels = n.height;
+    if (visual.contourGeneration != contourGeneration || visual.contourLevels < levels) {
+        if (visual.contourGeneration == contourGeneration) contourGarbage += 2 * visual.contourLevels;
+        visual.contour = static_cast<int>(contourArena.size());
+        visual.contourLevels = levels;
+        visual.contourGeneration = contourGeneration;
+        contourArena.resize(contourArena.size() + 2 * levels);
+    }
+
+    int leftLevels = at(n.left).height;
+    int rightLevels = at(n.right).height;
+    const int* left = contourArena.data() + visuals[n.left].contour;
+    const int* right = contourArena.data() + visuals[n.right].contour;
+    int offset = NODE_SEPARATION / 2; // A lone child still leans to its side
+    if (n.left && n.right) {
+        int overlap = 0;
+        for (int k = 0; k < std::min(leftLevels, rightLevels); ++k)
+            overlap = std::max(overlap, left[2 * k + 1] - right[2 * k]);
+        offset = (overlap + NODE_SEPARATION + 1) / 2;
+    }
+    visual.childOffset = offset;
+
+    int* out = contourArena.data() + visual.contour;
+    out[0] = 0;
+    out[1] = 0;
+    visual.extentLeft = 0;
+    visual.extentRight = 0;
+    for (int k = 0; k + 1 < levels; ++k) {
+        int lo = INT_MAX;
+        int hi = INT_MIN;
+        if (k < leftLevels) {
+            lo = left[2 * k] - offset;
+            hi = left[2 * k + 1] - offset;
+        }
+        if (k < rightLevels) {
+            lo = std::min(lo, right[2 * k] + offset);
+            hi = std::max(hi, right[2 * k + 1] + offset);
+        }
+        out[2 * k + 2] = lo;
+        out[2 * k + 3] = hi;
+        visual.extentLeft = std::min(visual.extentLeft, lo);
+        visual.extentRight = std::max(visual.extentRight, hi);
+    }
+}
+
+// Tidy layout in two iterative passes. Contours depend only on a subtree's shape, so the
+// bottom-up pass recomputes them just for nodes flagged by an edit (always a path up from
+// the root plus rotated nodes) or left over from before a compaction; shared subtrees
+// keep theirs across versions. The top-down pass then turns child offsets into targets,
+// skipping any clean subtree that lands where it already is. That last shortcut only
+// holds while the visuals describe the previous current tree: a shared node may sit
+// elsewhere in another version, so switching versions places every node again.
+void AVLTree::calculatePositions(int node, int x, int y) {
+    core.refresh(); // Contours are sized from heights, which relaxed inserts may leave stale
+    if (contourGarbage > 4096 && contourGarbage * 2 > contourArena.size()) {
+        contourArena.clear();
+        contourGarbage = 0;
+        contourGeneration++;
+    }
+
+    struct Frame { int node; bool merged; };
+    Frame order[2 * MAX_HEIGHT + 2];
+    int top = 0;
+    if (node && contourStale(node)) order[top++] = { node, false };
+    while (top > 0) {
+        Frame& frame = order[top - 1];
+        int current = frame.node;
+        if (frame.merged) {
+            computeContour(current);
+            core.flags(current) |= Node::DIRTY; // Make sure the placing pass visits it
+            top--;
+            continue;
+        }
+        frame.merged = true;
+        const Node& n = at(current);
+        if (n.right && contourStale(n.right)) order[top++] = { n.right, false };
+        if (n.left && contourStale(n.left)) order[top++] = { n.left, false };
+    }
+
+    struct Place { int node, x, y; };
+    Place stack[MAX_HEIGHT + 1];
+    bool everything = !layoutValid;
+    layoutValid = true;
+    if (node) stack[top++] = { node, x, y };
+
+    while (top > 0) {
+        Place place = stack[--top];
+        const Node& n = at(place.node);
+        NodeVisual& visual = visuals[place.node];
+        float targetX = static_cast<float>(place.x);
+        float targetY = static_cast<float>(place.y);
+        if (!everything && !(n.flags & Node::DIRTY) && visual.targetX == targetX && visual.targetY == targetY)
+            continue;
+        core.flags(place.node) &= ~Node::DIRTY;
+        setTarget(place.node, targetX, targetY);
+
+        if (n.right)
+            stack[top++] = { n.right, place.x + visual.childOffset, place.y + LEVEL_SEPARATION };
+        if (n.left)
+            stack[top++] = { n.left, place.x - visual.childOffset, place.y + LEVEL_SEPARATION };
+    }
+}
+
+// Sends node towards (x, y), entering it into the moving arrays unless it is already there
+void AVLTree::setTarget(int node, float x, float y) {
+    NodeVisual& visual = visuals[node];
+    visual.targetX = x;
+    visual.targetY = y;
+    if (visual.movingSlot) {
+        movingTargetX[visual.movingSlot - 1] = x;
+        movingTargetY[visual.movingSlot - 1] = y;
+    }
+    else if (visual.x != x || visual.y != y) {
+        movingNodes.push_back(node);
+        movingX.push_back(visual.x);
+        movingY.push_back(visual.y);
+        movingTargetX.push_back(x);
+        movingTargetY.push_back(y);
+        visual.movingSlot = static_cast<int>(movingNodes.size());
+    }
+}
+
+// Drops node from the moving arrays by moving the last entry into its slot
+void AVLTree::stopMoving(int node) {
+    int slot = visuals[node].movingSlot - 1;
+    int last = static_cast<int>(movingNodes.size()) - 1;
+    visuals[node].movingSlot = 0;
+    if (slot != last) {
+        movingNodes[slot] = movingNodes[last];
+        movingX[slot] = movingX[last];
+        movingY[slot] = movingY[last];
+        movingTargetX[slot] = movingTargetX[last];
+        movingTargetY[slot] = movingTargetY[last];
+        visuals[movingNodes[slot]].movingSlot = slot + 1;
+    }
+    movingNodes.pop_back();
+    movingX.pop_back();
+    movingY.pop_back();
+    movingTargetX.pop_back();
+    movingTargetY.pop_back();
+}
 
-    node->targetX = static_cast<float>(x);
-    node->targetY = static_cast<float>(y);
+// Only nodes whose target moved are in the arrays, so a tree at rest costs nothing here
+static const float SETTLE_DELAY = 1.5f; // Seconds without edits before a relaxed tree settles
 
-    int verticalSpacing = 100;
-    int adjustedXOffset = xOffset / (depth > 1 ? depth : 1);
-    adjustedXOffset = std::max(100, adjustedXOffset);
+void AVLTree::setRelaxed(bool on) {
+    core.setRelaxed(on);
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
+}
 
-    if (node->left)
-        calculatePositions(node->left, x - adjustedXOffset, y + verticalSpacing, xOffset, depth + 1);
-    if (node->right)
-        calculatePositions(node->right, x + adjustedXOffset, y + verticalSpacing, xOffset, depth + 1);
+void AVLTree::settle() {
+    core.settle();
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
 }
 
 void AVLTree::updateAnimation(float deltaTime) {
-    std::vector<Node*> nodes;
-    std::vector<Node*> stack = { root };
+    // Deferred rebalancing runs once the edits pause and the last one has finished moving
+    if (core.hasPending()) {
+        settleTimer += deltaTime;
+        if (settleTimer >= SETTLE_DELAY && movingNodes.empty()) settle();
+    }
 
-    while (!stack.empty()) {
-        Node* node = stack.back();
-        stack.pop_back();
-        if (node) {
-            nodes.push_back(node);
-            if (node->left) stack.push_back(node->left);
-            if (node->right) stack.push_back(node->right);
-        }
+    int count = static_cast<int>(movingNodes.size());
+    float step = instantMode ? 1.0f : deltaTime * 0.5f;
+    float* x = movingX.data();
+    float* y = movingY.data();
+    const float* targetX = movingTargetX.data();
+    const float* targetY = movingTargetY.data();
+    for (int i = 0; i < count; ++i) {
+        x[i] += (targetX[i] - x[i]) * step;
+        y[i] += (targetY[i] - y[i]) * step;
     }
 
-    for (Node* node : nodes) {
-        if (instantMode) {
-            node->x = node->targetX;
-            node->y = node->targetY;
+    // Write back, and let nodes within half a pixel of their target snap and rest
+    for (int i = count - 1; i >= 0; --i) {
+        NodeVisual& visual = visuals[movingNodes[i]];
+        if (std::fabs(targetX[i] - x[i]) < 0.5f && std::fabs(targetY[i] - y[i]) < 0.5f) {
+            visual.x = targetX[i];
+            visual.y = targetY[i];
+            stopMoving(movingNodes[i]);
         }
         else {
-            float dx = node->targetX - node->x;
-            float dy = node->targetY - node->y;
-            node->x += dx * deltaTime * 0.5f;
-            node->y += dy * deltaTime * 0.5f;
+            visual.x = x[i];
+            visual.y = y[i];
         }
     }
 }
 
-void AVLTree::drawNode(Node* node, const std::vector<Node*>& highlightPath) {
-    if (!node) return;
+// Stamps the nodes to highlight with a fresh generation, which also unmarks everything
+// highlighted before, so drawing checks one field per node instead of scanning the path
+void AVLTree::setHighlight(const int* path, int count) {
+    highlightGeneration++;
+    for (int i = 0; i < count; ++i)
+        visuals[path[i]].highlightStamp = highlightGeneration;
+}
 
+void AVLTree::drawNode(int node, bool label) {
     Color color = { 100, 200, 150, 255 };
-    bool isHighlighted = false;
-    for (const Node* pathNode : highlightPath) {
-        if (node == pathNode) {
-            color = { 255, 165, 0, 255 };
-            isHighlighted = true;
-            break;
-        }
-    }
+    bool isHighlighted = visuals[node].highlightStamp == highlightGeneration;
+    if (isHighlighted) color = { 255, 165, 0, 255 };
 
     float pulse = sin(GetTime() * 5.0f) * 0.1f + 1.0f;
-    float radius = isHighlighted ? 20 * pulse : 20;
+    float radius = isHighlighted ? NODE_RADIUS * pulse : NODE_RADIUS;
+
+    const NodeVisual& visual = visuals[node];
+    DrawCircle(static_cast<int>(visual.x), static_cast<int>(visual.y), radius, color);
+    DrawCircleLines(static_cast<int>(visual.x), static_cast<int>(visual.y), radius, DARKGRAY);
+    if (at(node).flags & Node::PENDING) {
+        // Out of balance, waiting for the relaxed tree to settle
+        int balance = at(at(node).left).height - at(at(node).right).height;
+        if (balance > 1 || balance < -1)
+            DrawCircleLines(static_cast<int>(visual.x), static_cast<int>(visual.y), radius + 4, RED);
+    }
+    if (label)
+        DrawText(TextFormat("%d", at(node).key), static_cast<int>(visual.x) - 10, static_cast<int>(visual.y) - 10, 20, BLACK);
+
+    int left = at(node).left;
+    int right = at(node).right;
+    if (left)
+        DrawLine(static_cast<int>(visual.x), static_cast<int>(visual.y), static_cast<int>(visuals[left].x), static_cast<int>(visuals[left].y), LIGHTGRAY);
+    if (right)
+        DrawLine(static_cast<int>(visual.x), static_cast<int>(visual.y), static_cast<int>(visuals[right].x), static_cast<int>(visuals[right].y), LIGHTGRAY);
+}
 
-    DrawCircle(static_cast<int>(node->x), static_cast<int>(node->y), radius, color);
-    DrawCircleLines(static_cast<int>(node->x), static_cast<int>(node->y), radius, DARKGRAY);
-    DrawText(std::to_string(node->key).c_str(), static_cast<int>(node->x) - 10, static_cast<int>(node->y) - 10, 20, BLACK);
+// Stand-in for a whole subtree too small to make out: a triangle over its box, with the
+// number of keys in it when that fits
+void AVLTree::drawSubtreeGlyph(int node, float left, float right, float bottom) {
+    const NodeVisual& visual = visuals[node];
+    Vector2 apex = { visual.x, visual.y };
+    Vector2 bottomLeft = { left, bottom };
+    Vector2 bottomRight = { right, bottom };
+    DrawTriangle(apex, bottomLeft, bottomRight, Fade({ 100, 200, 150, 255 }, 0.6f));
+
+    const char* size = TextFormat("%d", at(node).size);
+    int fontSize = static_cast<int>((bottom - visual.y) / 3);
+    if (fontSize > 0 && MeasureText(size, fontSize) < right - left)
+        DrawText(size, static_cast<int>((left + right) / 2) - MeasureText(size, fontSize) / 2, static_cast<int>(bottom) - fontSize, fontSize, BLACK);
+}
 
-    if (node->left) {
-        DrawLine(static_cast<int>(node->x), static_cast<int>(node->y), static_cast<int>(node->left->x), static_cast<int>(node->left->y), LIGHTGRAY);
-        drawNode(node->left, highlightPath);
-    }
-    if (node->right) {
-        DrawLine(static_cast<int>(node->x), static_cast<int>(node->y), static_cast<int>(node->right->x), static_cast<int>(node->right->y), LIGHTGRAY);
-        drawNode(node->right, highlightPath);
+// Draws the tree in world space (call inside BeginMode2D). Subtree boxes come from the
+// laid-out targets, so a subtree whose box misses the view is skipped whole, and one that
+// would be narrower than LOD_PIXELS on screen is drawn as a single glyph. The nodes drawn
+// are then bounded by the screen area rather than the tree size.
+void AVLTree::draw(const Camera2D& camera) {
+    Vector2 viewMin = GetScreenToWorld2D({ 0, 0 }, camera);
+    Vector2 viewMax = GetScreenToWorld2D({ static_cast<float>(GetScreenWidth()), static_cast<float>(GetScreenHeight()) }, camera);
+    bool labels = camera.zoom >= 0.5f; // Smaller text cannot be read anyway
+
+    int stack[MAX_HEIGHT + 1];
+    int top = 0;
+    if (core.getRoot()) stack[top++] = core.getRoot();
+    while (top > 0) {
+        int node = stack[--top];
+        const Node& n = at(node);
+        const NodeVisual& visual = visuals[node];
+        float left = visual.targetX + visual.extentLeft - NODE_RADIUS;
+        float right = visual.targetX + visual.extentRight + NODE_RADIUS;
+        float upper = visual.targetY - NODE_RADIUS;
+        float lower = visual.targetY + (n.height - 1) * LEVEL_SEPARATION + NODE_RADIUS;
+        if (right < viewMin.x || left > viewMax.x || lower < viewMin.y || upper > viewMax.y)
+            continue;
+        if (n.size > 1 && (right - left) * camera.zoom < LOD_PIXELS) {
+            drawSubtreeGlyph(node, left, right, lower);
+            continue;
+        }
+        drawNode(node, labels);
+        if (n.right) stack[top++] = n.right;
+        if (n.left) stack[top++] = n.left;
     }
 }
 
-void AVLTree::draw(const std::vector<Node*>& highlightPath) {
-    if (root) {
-        drawNode(root, highlightPath);
-    }
+// World-space box around the laid-out tree, for fitting the camera to it
+Rectangle AVLTree::getBounds() {
+    int root = core.getRoot();
+    if (!root) return { 0, 0, 0, 0 };
+    const NodeVisual& visual = visuals[root];
+    float left = visual.targetX + visual.extentLeft - NODE_RADIUS;
+    float right = visual.targetX + visual.extentRight + NODE_RADIUS;
+    float height = static_cast<float>((at(root).height - 1) * LEVEL_SEPARATION + 2 * NODE_RADIUS);
+    return { left, visual.targetY - NODE_RADIUS, right - left, height };
+}
+
+// Applies the operation between the current tree and the given keys as one undoable step
+void AVLTree::combine(SetOperation operation, std::vector<int>& keys) {
+    recordHistory(TreeOperation::COMBINE, 0);
+    core.combine(operation, keys);
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
+}
+
+void AVLTree::combine(SetOperation operation, AVLTree& other) {
+    recordHistory(TreeOperation::COMBINE, 0);
+    core.combine(operation, other.core);
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
+}
+
+int AVLTree::insertBatch(std::vector<int>& keys) {
+    recordHistory(TreeOperation::COMBINE, 0);
+    int added = core.insertBatch(keys);
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
+    return added;
+}
+
+int AVLTree::eraseBatch(std::vector<int>& keys) {
+    recordHistory(TreeOperation::COMBINE, 0);
+    int removed = core.eraseBatch(keys);
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
+    return removed;
 }
 
 void AVLTree::generateRandom(int count, int minValue, int maxValue) {
@@ -438,14 +671,15 @@ void AVLTree::generateRandom(int count, int minValue, int maxValue) {
     std::mt19937 gen(rd());
     std::uniform_int_distribution<> dis(minValue, maxValue);
 
-    for (int i = 0; i < count; ++i) {
-        int randomKey = dis(gen);
-        std::string dummyResult;
-        insert(randomKey, dummyResult);
-    }
+    std::vector<int> keys;
+    for (int i = 0; i < count; ++i)
+        keys.push_back(dis(gen));
+    insertBatch(keys);
 }
 
-void AVLTree::LoadFromFile(std::string& searchResult) {
+// Asks for a text file and reads every integer in it. Returns false (with the reason in
+// searchResult) when no file could be read.
+static bool readKeysFromFile(std::vector<int>& keys, std::string& fileName, std::string& searchResult) {
     const char* filters[] = { "*.txt" };
     const char* filePath = tinyfd_openFileDialog(
         "Select a Text File",
@@ -458,7 +692,7 @@ void AVLTree::LoadFromFile(std::string& searchResult) {
 
     if (!filePath) {
         searchResult = "File selection canceled.";
-        return;
+        return false;
     }
 
 #ifdef _WIN32
@@ -468,44 +702,186 @@ void AVLTree::LoadFromFile(std::string& searchResult) {
     errno_t err = _wfopen_s(&file, wideFilePath.c_str(), L"r");
     if (err != 0 || file == nullptr) {
         searchResult = "Failed to open file: " + std::string(filePath);
-        return;
+        return false;
     }
 #else
     FILE* file = fopen(filePath, "r");
     if (!file) {
         searchResult = "Failed to open file: " + std::string(filePath);
-        return;
+        return false;
     }
 #endif
 
-    clear();
-
+    fileName = filePath;
     int value;
-    int count = 0;
+    while (fscanf_s(file, "%d", &value) == 1) {
+        keys.push_back(value);
+    }
+    fclose(file);
+    return true;
+}
+
+void AVLTree::LoadFromFile(std::string& searchResult) {
+    std::vector<int> keys;
+    std::string filePath;
+    if (!readKeysFromFile(keys, filePath, searchResult)) return;
+    int count = static_cast<int>(keys.size());
+
+    // Build the whole file as one balanced version instead of inserting key by key,
+    // so the load costs O(N) after sorting and undoes in a single step
+    recordHistory(TreeOperation::LOAD, 0);
+    core.assign(keys);
+    // A load is usually followed by lookups, so serve them from the frozen copy until the next edit
+    core.freeze();
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
+
     if (instantMode) {
-        while (fscanf_s(file, "%d", &value) == 1) {
-            std::string dummyResult;
-            insert(value, dummyResult);
-            calculatePositions(root, GetScreenWidth() / 2, 50, 300, 1);
-            updateAnimation(0.0f);
-            count++;
-        }
-        searchResult = "Instantly loaded " + std::to_string(count) + " values from " + std::string(filePath);
+        updateAnimation(0.0f);
+        searchResult = "Instantly loaded " + std::to_string(count) + " values from " + filePath;
     }
     else {
-        std::vector<Node*> path;
-        while (fscanf_s(file, "%d", &value) == 1) {
-            path.clear();
-            std::string dummyResult;
-            root = insert(root, value, path, dummyResult, currentCodePath);
-            calculatePositions(root, GetScreenWidth() / 2, 50, 300, 1);
-            count++;
-        }
-        searchResult = "Loaded " + std::to_string(count) + " values from " + std::string(filePath);
+        searchResult = "Loaded " + std::to_string(count) + " values from " + filePath;
+    }
+}
+
+// Writes the tree as a binary snapshot, which LoadSnapshot maps back without parsing
+void AVLTree::SaveSnapshot(std::string& searchResult) {
+    const char* filters[] = { "*.avl" };
+    const char* filePath = tinyfd_saveFileDialog(
+        "Save Binary Snapshot",
+        "tree.avl",
+        1,
+        filters,
+        "AVL Snapshots"
+    );
+
+    if (!filePath) {
+        searchResult = "Save canceled.";
+        return;
+    }
+    // Written beside the target and renamed over it, so a snapshot that is mapped (maybe
+    // the one this tree is using, under another spelling of its path) is never truncated
+    std::string target = filePath;
+    std::string temporary = target + ".tmp";
+
+#ifdef _WIN32
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    std::wstring wideFilePath = converter.from_bytes(temporary);
+    FILE* file = nullptr;
+    errno_t err = _wfopen_s(&file, wideFilePath.c_str(), L"wb");
+    if (err != 0 || file == nullptr) {
+        searchResult = "Failed to open file: " + temporary;
+        return;
+    }
+#else
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) {
+        searchResult = "Failed to open file: " + temporary;
+        return;
+    }
+#endif
+
+    bool written = core.writeBinary(file);
+    written = fclose(file) == 0 && written;
+    if (!written || !replaceFile(temporary, target)) {
+        removeFile(temporary);
+        searchResult = "Failed to write " + target + (written ? " (is it in use?)" : "");
+        return;
+    }
+    searchResult = "Saved " + std::to_string(getSize()) + " keys to " + target;
+}
+
+// Maps a binary snapshot and uses its nodes as they are: no parsing and no per-node
+// allocation, so even millions of keys load at once (pages are read as they are touched)
+void AVLTree::LoadSnapshot(std::string& searchResult) {
+    const char* filters[] = { "*.avl" };
+    const char* filePath = tinyfd_openFileDialog(
+        "Open Binary Snapshot",
+        "",
+        1,
+        filters,
+        "AVL Snapshots",
+        0
+    );
+
+    if (!filePath) {
+        searchResult = "File selection canceled.";
+        return;
+    }
+
+    // Mapped on the side, and adoptBinary checks it before replacing anything, so a file
+    // that fails leaves the tree and its history as they were
+    MappedFile file;
+    if (!file.open(filePath)) {
+        searchResult = "Failed to open file: " + std::string(filePath);
+        return;
+    }
+    if (!core.adoptBinary(file.data(), file.size())) {
+        searchResult = "Not a snapshot this build can read: " + std::string(filePath);
+        return;
+    }
+    // The snapshot replaced the whole node pool, so no undo step survives it. The previous
+    // mapping (if any) no longer holds a node and goes with file.
+    nodesDropped();
+    binaryFile.swap(file);
+    visuals.assign(core.capacity(), NodeVisual());
+    layoutValid = false;
+    publish();
+    calculatePositions(core.getRoot(), GetScreenWidth() / 2, 50);
+    if (instantMode) updateAnimation(0.0f);
+    searchResult = "Mapped " + std::to_string(getSize()) + " keys from " + std::string(filePath);
+}
+
+void AVLTree::CombineWithFile(SetOperation operation, std::string& searchResult) {
+    std::vector<int> keys;
+    std::string filePath;
+    if (!readKeysFromFile(keys, filePath, searchResult)) return;
+
+    int before = getSize();
+    combine(operation, keys);
+    if (instantMode) updateAnimation(0.0f);
+    const char* name = operation == SetOperation::UNION ? "Union" : operation == SetOperation::INTERSECTION ? "Intersection" : "Difference";
+    searchResult = std::string(name) + " with " + filePath + ": " + std::to_string(before) + " -> " + std::to_string(getSize()) + " keys";
+}
+void AVLTree::ExportToFile(std::string& searchResult) {
+    const char* filters[] = { "*.txt" };
+    const char* filePath = tinyfd_saveFileDialog(
+        "Export Sorted Keys",
+        "keys.txt",
+        1,
+        filters,
+        "Text Files"
+    );
+
+    if (!filePath) {
+        searchResult = "Export canceled.";
+        return;
+    }
+
+#ifdef _WIN32
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    std::wstring wideFilePath = converter.from_bytes(filePath);
+    FILE* file = nullptr;
+    errno_t err = _wfopen_s(&file, wideFilePath.c_str(), L"w");
+    if (err != 0 || file == nullptr) {
+        searchResult = "Failed to open file: " + std::string(filePath);
+        return;
     }
+#else
+    FILE* file = fopen(filePath, "w");
+    if (!file) {
+        searchResult = "Failed to open file: " + std::string(filePath);
+        return;
+    }
+#endif
 
+    // Streams straight from the tree, one key per line, in the format LoadFromFile reads
+    int count = rangeScan(INT_MIN, INT_MAX, [file](int key) { fprintf(file, "%d\n", key); });
     fclose(file);
+    searchResult = "Exported " + std::to_string(count) + " keys to " + std::string(filePath);
 }
+
 void AVLTree::DrawCodeBox(int screenWidth, int screenHeight, int currentCodeIndex) {
     static float codeBoxAlpha = 0.0f;
     static float codeBoxY = static_cast<float>(screenHeight);
@@ -553,14 +929,15 @@ void AVLTree::DrawCodeBox(int screenWidth, int screenHeight, int currentCodeInde
         codeBoxY = static_cast<float>(screenHeight);
     }
 }
+
 void runAVL() {
     const int screenWidth = 1400;
     const int screenHeight = 1000;
 
     AVLTree tree;
-    std::vector<Node*> searchPath;
-    std::vector<Node*> insertPath;
-    std::vector<Node*> affectedPath;
+    std::vector<int> searchPath;
+    std::vector<int> insertPath;
+    std::vector<int> affectedPath;
     char inputBuffer[10] = "";
     int inputIndex = 0;
     float operationTimer = 0.0f;
@@ -569,6 +946,8 @@ void runAVL() {
     bool inserting = false;
     std::string searchResult = "";
     int lastSearchValue = 0;
+    std::string queryResult = ""; // Shown once a rank/select/range descent finishes animating
+    Camera2D camera = { { 0, 0 }, { 0, 0 }, 0.0f, 1.0f }; // Right-drag pans, the mouse wheel zooms around the cursor
 
     Rectangle insertButton = { 20, screenHeight - 120, 100, 40 };
     Rectangle deleteButton = { 130, screenHeight - 120, 100, 40 };
@@ -579,6 +958,16 @@ void runAVL() {
     Rectangle redoButton = { 680, screenHeight - 120, 100, 40 };
     Rectangle FileButton = { 790, screenHeight - 120, 100, 40 };
     Rectangle inputBox = { 20, screenHeight - 60, 100, 40 };
+    Rectangle rankButton = { 130, screenHeight - 60, 100, 40 };
+    Rectangle selectButton = { 240, screenHeight - 60, 100, 40 };
+    Rectangle rangeButton = { 350, screenHeight - 60, 100, 40 };
+    Rectangle unionButton = { 460, screenHeight - 60, 100, 40 };
+    Rectangle intersectButton = { 570, screenHeight - 60, 100, 40 };
+    Rectangle differenceButton = { 680, screenHeight - 60, 100, 40 };
+    Rectangle exportButton = { 790, screenHeight - 60, 100, 40 };
+    Rectangle fitButton = { 900, screenHeight - 60, 100, 40 };
+    Rectangle saveBinaryButton = { 1120, screenHeight - 120, 100, 40 };
+    Rectangle loadBinaryButton = { 1120, screenHeight - 60, 100, 40 };
     Rectangle returnButton = { screenWidth - 120, 10, 100, 40 };
 
     Color TEAL = { 0, 128, 128, 255 };
@@ -599,6 +988,19 @@ void runAVL() {
             }
             key = GetCharPressed();
         }
+        // Camera: zoom keeps the world point under the cursor fixed
+        float wheel = GetMouseWheelMove();
+        if (wheel != 0) {
+            camera.target = GetScreenToWorld2D(GetMousePosition(), camera);
+            camera.offset = GetMousePosition();
+            camera.zoom = std::min(4.0f, std::max(0.01f, camera.zoom * (1.0f + 0.1f * wheel)));
+        }
+        if (IsMouseButtonDown(MOUSE_RIGHT_BUTTON)) {
+            Vector2 delta = GetMouseDelta();
+            camera.target.x -= delta.x / camera.zoom;
+            camera.target.y -= delta.y / camera.zoom;
+        }
+
         // Handle backspace for input box
         if (IsKeyPressed(KEY_BACKSPACE) && inputIndex > 0) {
             inputBuffer[--inputIndex] = '\0';
@@ -612,7 +1014,18 @@ void runAVL() {
         bool undoHover = CheckCollisionPointRec(GetMousePosition(), undoButton);
         bool redoHover = CheckCollisionPointRec(GetMousePosition(), redoButton);
         bool FileHover = CheckCollisionPointRec(GetMousePosition(), FileButton);
+        bool rankHover = CheckCollisionPointRec(GetMousePosition(), rankButton);
+        bool selectHover = CheckCollisionPointRec(GetMousePosition(), selectButton);
+        bool rangeHover = CheckCollisionPointRec(GetMousePosition(), rangeButton);
+        bool unionHover = CheckCollisionPointRec(GetMousePosition(), unionButton);
+        bool intersectHover = CheckCollisionPointRec(GetMousePosition(), intersectButton);
+        bool differenceHover = CheckCollisionPointRec(GetMousePosition(), differenceButton);
+        bool exportHover = CheckCollisionPointRec(GetMousePosition(), exportButton);
+        bool fitHover = CheckCollisionPointRec(GetMousePosition(), fitButton);
+        bool saveBinaryHover = CheckCollisionPointRec(GetMousePosition(), saveBinaryButton);
+        bool loadBinaryHover = CheckCollisionPointRec(GetMousePosition(), loadBinaryButton);
         bool instantHover = CheckCollisionPointRec(GetMousePosition(), tree.instantBtn);
+        bool relaxedHover = CheckCollisionPointRec(GetMousePosition(), tree.relaxedBtn);
         bool returnHover = CheckCollisionPointRec(GetMousePosition(), returnButton);
 
         bool insertClicked = isButtonClicked(insertButton) || (IsKeyPressed(KEY_ENTER) && inputIndex > 0);
@@ -623,7 +1036,18 @@ void runAVL() {
         bool undoClicked = isButtonClicked(undoButton);
         bool redoClicked = isButtonClicked(redoButton);
         bool FileClicked = isButtonClicked(FileButton);
+        bool rankClicked = isButtonClicked(rankButton);
+        bool selectClicked = isButtonClicked(selectButton);
+        bool rangeClicked = isButtonClicked(rangeButton);
+        bool unionClicked = isButtonClicked(unionButton);
+        bool intersectClicked = isButtonClicked(intersectButton);
+        bool differenceClicked = isButtonClicked(differenceButton);
+        bool exportClicked = isButtonClicked(exportButton);
+        bool fitClicked = isButtonClicked(fitButton);
+        bool saveBinaryClicked = isButtonClicked(saveBinaryButton);
+        bool loadBinaryClicked = isButtonClicked(loadBinaryButton);
         bool instantClicked = isButtonClicked(tree.instantBtn);
+        bool relaxedClicked = isButtonClicked(tree.relaxedBtn);
         bool returnClicked = isButtonClicked(returnButton);
 
         if (instantClicked) {
@@ -640,6 +1064,10 @@ void runAVL() {
                 tree.currentCodePath.clear();
             }
         }
+        if (relaxedClicked) {
+            tree.setRelaxed(!tree.isRelaxed());
+            searchResult = tree.isRelaxed() ? "Relaxed balance ON: rotations wait until edits pause" : "Strict balance ON";
+        }
 
         if (insertClicked && inputIndex > 0) {
             try {
@@ -708,6 +1136,7 @@ void runAVL() {
         if (searchClicked && inputIndex > 0) {
             try {
                 lastSearchValue = std::stoi(inputBuffer);
+                queryResult = "";
                 tree.currentOperation = "search";
                 tree.currentCodePath.clear();
                 tree.search(lastSearchValue, searchPath, tree.currentCodePath);
@@ -720,7 +1149,7 @@ void runAVL() {
                     searchResult = "Searching for " + std::to_string(lastSearchValue) + "...";
                 }
                 else {
-                    if (!searchPath.empty() && searchPath.back()->key == lastSearchValue) {
+                    if (!searchPath.empty() && tree.getKey(searchPath.back()) == lastSearchValue) {
                         searchResult = "Node " + std::to_string(lastSearchValue) + " is found";
                     }
                     else {
@@ -740,6 +1169,48 @@ void runAVL() {
                 inputBuffer[0] = '\0';
             }
         }
+        if ((rankClicked || selectClicked || rangeClicked) && inputIndex > 0) {
+            // Rank and Select take one number, Range takes "lo,hi"
+            int lo = 0;
+            int hi = 0;
+            int parsed = sscanf_s(inputBuffer, "%d%*[ ,]%d", &lo, &hi);
+            if (parsed < 1 || (rangeClicked && parsed < 2)) {
+                searchResult = rangeClicked ? "Invalid input. Please enter lo,hi." : "Invalid input. Please enter a number.";
+            }
+            else {
+                if (rankClicked) {
+                    int smaller = tree.rank(lo, searchPath);
+                    queryResult = std::to_string(smaller) + " keys are smaller than " + std::to_string(lo);
+                }
+                else if (selectClicked) {
+                    int node = tree.select(lo, searchPath);
+                    queryResult = node ? "Key #" + std::to_string(lo) + " is " + std::to_string(tree.getKey(node))
+                                       : "There is no key #" + std::to_string(lo);
+                }
+                else {
+                    int count = tree.countRange(lo, hi, searchPath);
+                    queryResult = std::to_string(count) + " keys in [" + std::to_string(lo) + ", " + std::to_string(hi) + "]";
+                }
+                inserting = false;
+                insertPath.clear();
+                tree.currentOperation = "";
+                tree.currentCodePath.clear();
+                if (!tree.instantMode && !searchPath.empty()) {
+                    operationIndex = 0;
+                    operationTimer = 0.0f;
+                    searching = true;
+                    searchResult = "Querying...";
+                }
+                else {
+                    searchResult = queryResult;
+                    queryResult = "";
+                    searching = false;
+                    searchPath.clear();
+                }
+            }
+            inputIndex = 0;
+            inputBuffer[0] = '\0';
+        }
         if (clearClicked) {
             tree.clear();
             searchPath.clear();
@@ -771,7 +1242,7 @@ void runAVL() {
             }
         }
         if (undoClicked) {
-            Node* affectedNode = tree.undo(affectedPath);
+            int affectedNode = tree.undo(affectedPath);
             searching = false;
             inserting = false;
             searchPath.clear();
@@ -786,7 +1257,7 @@ void runAVL() {
             }
         }
         if (redoClicked) {
-            Node* affectedNode = tree.redo(affectedPath);
+            int affectedNode = tree.redo(affectedPath);
             searching = false;
             inserting = false;
             searchPath.clear();
@@ -810,6 +1281,52 @@ void runAVL() {
             inputIndex = 0;
             inputBuffer[0] = '\0';
         }
+        if (fitClicked) {
+            // Zoom out until the whole tree fits above the buttons (never past 1:1)
+            Rectangle bounds = tree.getBounds();
+            camera.offset = { screenWidth / 2.0f, 30.0f };
+            camera.target = { bounds.x + bounds.width / 2, bounds.y };
+            camera.zoom = 1.0f;
+            if (bounds.width > 0) {
+                float fitX = screenWidth * 0.95f / bounds.width;
+                float fitY = (screenHeight - 180) / bounds.height;
+                camera.zoom = std::max(0.01f, std::min(1.0f, std::min(fitX, fitY)));
+            }
+        }
+        if (exportClicked) {
+            tree.ExportToFile(searchResult);
+            searching = false;
+            inserting = false;
+            searchPath.clear();
+            insertPath.clear();
+        }
+        if (saveBinaryClicked) {
+            tree.SaveSnapshot(searchResult);
+        }
+        if (loadBinaryClicked) {
+            tree.LoadSnapshot(searchResult);
+            searchPath.clear();
+            insertPath.clear();
+            affectedPath.clear();
+            inserting = false;
+            searching = false;
+            tree.currentOperation = "";
+            tree.currentCodePath.clear();
+            inputIndex = 0;
+            inputBuffer[0] = '\0';
+        }
+        if (unionClicked || intersectClicked || differenceClicked) {
+            SetOperation operation = unionClicked ? SetOperation::UNION : intersectClicked ? SetOperation::INTERSECTION : SetOperation::DIFFERENCE;
+            tree.CombineWithFile(operation, searchResult);
+            searchPath.clear();
+            insertPath.clear();
+            inserting = false;
+            searching = false;
+            tree.currentOperation = "";
+            tree.currentCodePath.clear();
+            inputIndex = 0;
+            inputBuffer[0] = '\0';
+        }
         // Only exit on backspace if input box is empty
         if (returnClicked || (IsKeyPressed(KEY_BACKSPACE) && inputIndex == 0)) {
             shouldReturn = true;
@@ -822,8 +1339,12 @@ void runAVL() {
                 operationTimer = 0.0f;
                 if (operationIndex >= static_cast<int>(searchPath.size())) {
                     operationIndex = 0;
-                    if (searching) {
-                        if (!searchPath.empty() && searchPath.back()->key == lastSearchValue) {
+                    if (searching && !queryResult.empty()) {
+                        searchResult = queryResult;
+                        queryResult = "";
+                    }
+                    else if (searching) {
+                        if (!searchPath.empty() && tree.getKey(searchPath.back()) == lastSearchValue) {
                             searchResult = "Node " + std::to_string(lastSearchValue) + " is found";
                         }
                         else {
@@ -846,17 +1367,21 @@ void runAVL() {
         ClearBackground(WHITE);
         DrawText("AVL Visualise", screenWidth / 2 - MeasureText("AVL Visualise", 100) / 2, screenHeight / 2 - 50, 100, Fade(GRAY, 0.2f));
 
-        std::vector<Node*> currentHighlight;
         int currentCodeIndex = -1;
         if ((searching || inserting) && !tree.instantMode && operationIndex < static_cast<int>(searchPath.size())) {
-            currentHighlight.push_back(searchPath[operationIndex]);
+            tree.setHighlight(&searchPath[operationIndex], 1);
             int codePathIndex = operationIndex * (tree.currentCodePath.size() / std::max(1, static_cast<int>(searchPath.size())));
             if (codePathIndex < static_cast<int>(tree.currentCodePath.size())) {
                 currentCodeIndex = tree.currentCodePath[codePathIndex];
             }
         }
+        else {
+            tree.setHighlight(nullptr, 0);
+        }
 
-        tree.draw(currentHighlight);
+        BeginMode2D(camera);
+        tree.draw(camera);
+        EndMode2D();
 
         tree.DrawCodeBox(screenWidth, screenHeight, currentCodeIndex);
 
@@ -868,13 +1393,24 @@ void runAVL() {
         drawButton(undoButton, "Undo", GRAY, undoHover, undoClicked);
         drawButton(redoButton, "Redo", TEAL, redoHover, redoClicked);
         drawButton(FileButton, "File", Mediumblue, FileHover, FileClicked);
+        drawButton(rankButton, "Rank", DARKGREEN, rankHover, rankClicked);
+        drawButton(selectButton, "Select", MAROON, selectHover, selectClicked);
+        drawButton(rangeButton, "Range", DARKBLUE, rangeHover, rangeClicked);
+        drawButton(unionButton, "Union", DARKGREEN, unionHover, unionClicked);
+        drawButton(intersectButton, "Intersect", MAROON, intersectHover, intersectClicked);
+        drawButton(differenceButton, "Diff", DARKBLUE, differenceHover, differenceClicked);
+        drawButton(exportButton, "Export", Mediumblue, exportHover, exportClicked);
+        drawButton(fitButton, "Fit", GRAY, fitHover, fitClicked);
+        drawButton(saveBinaryButton, "Save Bin", Mediumblue, saveBinaryHover, saveBinaryClicked);
+        drawButton(loadBinaryButton, "Load Bin", Mediumblue, loadBinaryHover, loadBinaryClicked);
         drawButton(tree.instantBtn, tree.instantMode ? "Instant" : "Step", instantColor, instantHover, instantClicked);
+        drawButton(tree.relaxedBtn, tree.isRelaxed() ? "Relaxed" : "Strict", ORANGE, relaxedHover, relaxedClicked);
         drawButton(returnButton, "Return", GRAY, returnHover, returnClicked);
 
         // Add visual feedback for invalid input
         bool isValidInput = true;
         for (int i = 0; i < inputIndex; ++i) {
-            if (inputBuffer[i] < '0' || inputBuffer[i] > '9') {
+            if ((inputBuffer[i] < '0' || inputBuffer[i] > '9') && inputBuffer[i] != ',') {
                 isValidInput = false;
                 break;
             }
@@ -883,8 +1419,11 @@ void runAVL() {
         DrawRectangleRec(inputBox, LIGHTGRAY);
         DrawRectangleLinesEx(inputBox, 2, inputBorderColor);
         DrawText(inputBuffer, inputBox.x + 5, inputBox.y + 10, 30, BLACK);
-        DrawText("Enter number, then click action or press Enter", inputBox.x, inputBox.y + 40, 20, DARKGRAY);
+        DrawText("Enter number (lo,hi for Range), then click action or press Enter", inputBox.x, inputBox.y + 40, 20, DARKGRAY);
         DrawText(searchResult.c_str(), 20, screenHeight - 160, 20, DARKGRAY);
+        int pending = tree.pendingCount();
+        if (pending)
+            DrawText(TextFormat("%d node%s awaiting rebalancing", pending, pending == 1 ? "" : "s"), 20, screenHeight - 190, 20, RED);
 
         EndDrawing();
     }
@@ -2,66 +2,211 @@
 #define AVL_H
 
 #include <vector>
-#include <stack>
+#include <deque>
 #include <utility>
 #include "tinyfiledialogs.h"
 #include <locale>
 #include <codecvt>
 #include <string>
+#include "AVLCore.h"
+#include "MappedFile.h"
 
-struct Node {
-    int key;
-    int height;
-    Node* left;
-    Node* right;
+// Animation/layout state, kept in a parallel array indexed like the nodes so searching
+// and rebalancing never pull it into cache.
+struct NodeVisual {
     float x, y;           // Current position for animation
     float targetX, targetY; // Target position for animation
+    int childOffset;      // Horizontal distance from this node to each child
+    int extentLeft, extentRight; // How far the subtree reaches left and right of this node
+    int contour;          // Start of this subtree's contour in the contour arena
+    int contourLevels;    // Levels that block has room for
+    int contourGeneration; // Arena generation the contour belongs to (0 = none)
+    int movingSlot;       // Index in the tree's moving arrays plus one, 0 while at rest
+    unsigned highlightStamp; // Highlighted while this equals the tree's highlight generation
     bool isDying;         // Flag for deletion animation (unused now, kept for compatibility)
-    Node(int value);
 };
 
+// Pseudocode lines visited by the last operation, kept in a fixed ring buffer so tracing
+// never allocates. Once full, the oldest lines are overwritten.
+class CodeTrace {
+private:
+    static const int CAPACITY = 1024; // Enough for an insert into a tree of MAX_HEIGHT levels
+    int lines[CAPACITY];
+    int start;
+    int count;
+
+public:
+    CodeTrace() : start(0), count(0) {}
+    void push_back(int line) {
+        lines[(start + count) % CAPACITY] = line;
+        if (count < CAPACITY) count++;
+        else start = (start + 1) % CAPACITY;
+    }
+    void clear() { start = 0; count = 0; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    int operator[](int i) const { return lines[(start + i) % CAPACITY]; }
+};
+
+class AVLTree;
+
+// Turns the engine's insert events into the insertCode lines the recursive pseudocode
+// would visit; line() is used directly by search
+struct RecordTrace {
+    static const bool ENABLED = true;
+    CodeTrace& trace;
+    void line(int index) { trace.push_back(index); }
+    void descend(bool left);
+    void create();
+    void climb(Rebalance rebalance);
+};
+
+// Keeps the tree's visuals array in step with the engine's node pool
+struct VisualHooks {
+    AVLTree* tree;
+    void created(int node, int copiedFrom);
+    void destroyed(int node);
+};
+
+enum class TreeOperation { INSERT, REMOVE, LOAD, COMBINE };
+
+// Key operations are logged as themselves and undone by applying their inverse. LOAD and
+// COMBINE have no such inverse, so they keep the whole other version as a checkpoint.
+struct HistoryEntry {
+    int version;             // Checkpoint root to swap back in (LOAD and COMBINE only)
+    TreeOperation operation;
+    int value;               // Key inserted or removed (unused for LOAD and COMBINE)
+};
+
+// Visualizer over an AVLCore<int>: the engine owns the nodes and the algorithms, this
+// class adds layout, animation, highlighting, undo history and the raylib UI.
 class AVLTree {
 private:
-    Node* root;
-    std::stack<std::pair<Node*, std::pair<bool, int>>> history; // <tree state, <wasInsert, value>>
-    std::stack<std::pair<Node*, std::pair<bool, int>>> redoStack;
-
-    Node* insert(Node* node, int key, std::vector<Node*>& path, std::string& searchResult, std::vector<int>& codePath);
-    Node* deleteNode(Node* node, int key);
-    Node* rightRotate(Node* y);
-    Node* leftRotate(Node* x);
-    Node* findMin(Node* node);
-    void deleteTree(Node* node);
-    int getHeight(Node* node);
-    int getBalance(Node* node);
-    void updateHeight(Node* node);
-    void calculatePositions(Node* node, int x, int y, int xOffset, int depth);
-    void drawNode(Node* node, const std::vector<Node*>& highlightPath);
-    Node* deepCopy(Node* node);
+    typedef AVLCore<int, std::less<int>, std::allocator<int>, VisualHooks> Core;
+    typedef Core::Node Node;
+    friend struct VisualHooks;
+
+    static const int MAX_HEIGHT = Core::MAX_HEIGHT;
+    static const int NODE_SEPARATION = 60;  // Closest two node centers on one level may be
+    static const int LEVEL_SEPARATION = 100;
+    static const int NODE_RADIUS = 20;
+    static const int LOD_PIXELS = 24; // Subtrees narrower than this on screen draw as one glyph
+
+    static const size_t DEFAULT_HISTORY_BUDGET = 64 << 20; // Bytes
+
+    MappedFile binaryFile; // Snapshot whose nodes the pool uses in place (declared first so it outlives core)
+    Core core; // Live tree and every checkpoint, sharing one node pool
+    Core::Finger finger; // Left by the last insert's duplicate check, so the insert itself starts there
+    std::vector<NodeVisual> visuals; // Indexed by node, sized to the pool's capacity
+    bool layoutValid; // False once the visuals may belong to another version (undo/redo)
+    // Leftmost and rightmost x of every level of a subtree, relative to its root, as
+    // [left, right] pairs. Blocks are owned by nodes and only rewritten when the subtree
+    // changes shape; compacting drops them all by moving to a new generation.
+    std::vector<int> contourArena;
+    size_t contourGarbage; // Arena ints no node owns any more
+    int contourGeneration;
+    // Nodes still travelling to their targets, with positions and targets packed so the
+    // tween is one flat loop; visuals get the new positions after each step
+    std::vector<int> movingNodes;
+    std::vector<float> movingX, movingY;
+    std::vector<float> movingTargetX, movingTargetY;
+    unsigned highlightGeneration; // Bumped to clear every highlight at once
+    // Next step to undo or redo at the back; steps furthest away are dropped from the front
+    std::deque<HistoryEntry> history;
+    std::deque<HistoryEntry> redoStack;
+    size_t historyBudget;
+    size_t historyBytes; // Estimated memory held by history and redoStack
+    float settleTimer; // Seconds since the last relaxed insert
+    bool sharedReads; // Edits are published for worker threads (see shareReads)
+
+    const Node& at(int node) const { return core.node(node); }
+    void visualCreated(int node, int copiedFrom);
+    void visualDestroyed(int node);
+    template <typename Tracer> void findPath(int key, std::vector<int>& searchPath, Tracer& tracer);
+    bool contourStale(int node);
+    void computeContour(int node);
+    void calculatePositions(int node, int x, int y);
+    void setTarget(int node, float x, float y);
+    void stopMoving(int node);
+    void drawNode(int node, bool label);
+    void drawSubtreeGlyph(int node, float left, float right, float bottom);
+    void recordHistory(TreeOperation operation, int value);
+    size_t historyCost(const HistoryEntry& entry);
+    HistoryEntry replay(const HistoryEntry& entry, bool undoing);
+    void dropEntry(const HistoryEntry& entry);
+    void trimHistory();
+    void nodesDropped();
+    // Lets worker threads see the change, once they share the tree
+    void publish() {
+        if (sharedReads) core.publish();
+    }
 
 public:
+    typedef Core::Iterator Iterator;
+
     AVLTree();
     ~AVLTree();
     void insert(int key, std::string& searchResult);
     void deleteNode(int key);
-    void search(int key, std::vector<Node*>& searchPath, std::vector<int>& codePath);
+    // Many keys as one undoable step with one layout pass; return how many keys changed
+    int insertBatch(std::vector<int>& keys);
+    int eraseBatch(std::vector<int>& keys);
+    void search(int key, std::vector<int>& searchPath, CodeTrace& codePath);
+    // Membership of many keys at once, without paths or code trace
+    void searchBatch(const int* keys, int count, bool* found) { core.searchBatch(keys, count, found); }
+    // Turns on publishing for worker threads. Until then edits skip it, since a published
+    // version makes the next edit copy its whole path instead of changing nodes in place.
+    void shareReads();
+    // Safe to call from worker threads while this one edits, once shareReads() was called;
+    // sees the tree as of the last edit
+    bool containsShared(int key) const {
+        Core::ReadGuard guard(core);
+        return guard.contains(key);
+    }
+    int getKey(int node) { return at(node).key; }
+    int getSize() { return core.getSize(); }
+    int rank(int key, std::vector<int>& path);
+    int select(int k, std::vector<int>& path);
+    int countRange(int lo, int hi, std::vector<int>& path);
+    Iterator begin() { return core.begin(); }
+    Iterator last() { return core.last(); }
+    Iterator lowerBound(int key) { return core.lowerBound(key); }
+    template <typename Callback> int rangeScan(int lo, int hi, Callback callback) { return core.rangeScan(lo, hi, callback); }
     void clear();
-    Node* undo(std::vector<Node*>& affectedPath);
-    Node* redo(std::vector<Node*>& affectedPath);
+    void freeze() { core.freeze(); }
+    // Relaxed mode defers rotations: nodes left out of balance are ringed, and the tree
+    // settles once edits pause for a moment or the mode is turned off
+    void setRelaxed(bool on);
+    bool isRelaxed() const { return core.isRelaxed(); }
+    int pendingCount() const { return core.pendingCount(); }
+    bool isBalanced() const { return core.isBalanced(); }
+    void settle();
+    int undo(std::vector<int>& affectedPath);
+    int redo(std::vector<int>& affectedPath);
     void clearHistory();
+    void setHistoryBudget(size_t bytes);
     void generateRandom(int count, int minValue, int maxValue);
     void updateAnimation(float deltaTime);
-    void draw(const std::vector<Node*>& highlightPath);
+    void setHighlight(const int* path, int count);
+    void draw(const Camera2D& camera);
+    Rectangle getBounds();
+    void combine(SetOperation operation, std::vector<int>& keys);
+    void combine(SetOperation operation, AVLTree& other);
     void LoadFromFile(std::string& searchResult);
+    void CombineWithFile(SetOperation operation, std::string& searchResult);
+    void ExportToFile(std::string& searchResult);
+    void SaveSnapshot(std::string& searchResult);
+    void LoadSnapshot(std::string& searchResult);
     bool instantMode; // For instant execution toggle
     Rectangle instantBtn; // Instant mode button
+    Rectangle relaxedBtn; // Relaxed balance button
 
     // Code table members
     void DrawCodeBox(int screenWidth, int screenHeight, int currentCodeIndex);
     std::vector<std::string> insertCode; // Pseudocode for insert
     std::vector<std::string> searchCode; // Pseudocode for search
-    std::vector<int> currentCodePath; // Indices of code lines to highlight
+    CodeTrace currentCodePath; // Indices of code lines to highlight
     std::string currentOperation; // "insert", "search", or "" (none)
 };
 
-#endif
\ No newline at end of file
+#endif
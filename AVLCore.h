@@ -0,0 +1,1698 @@
+#ifndef AVL_CORE_H
+#define AVL_CORE_H
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#ifdef _MSC_VER
+#include <xmmintrin.h>
+#define AVL_PREFETCH(address) _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#else
+#define AVL_PREFETCH(address) __builtin_prefetch(address)
+#endif
+
+// The balanced ordered-set engine behind the AVL visualizer. It has no drawing and no
+// dialogs, so it can serve as an ordered index anywhere: keys are any copyable,
+// default-constructible type ordered by Compare (a strict weak ordering).
+
+// Search-path data only. Nodes live in a NodePool and refer to each other by index;
+// index 0 is a shared empty sentinel (height 0), so "no child" needs no null checks.
+template <typename Key>
+struct AVLNode {
+    static const unsigned char DIRTY = 1; // Shape or size changed since the owner last cleared it
+    static const unsigned char PENDING = 2; // Subtree may hold nodes out of AVL balance (relaxed inserts)
+
+    Key key;
+    unsigned char height; // AVL height stays below MAX_HEIGHT
+    unsigned char flags;
+    int size; // Keys in this subtree, for rank/select
+    int left;
+    int right;
+    int refs; // Parent links and versions sharing this node (nodes are immutable while refs > 1)
+};
+
+// Slab allocator for tree nodes: allocation is a bump through the current slab (or a pop
+// from the free list), and dropping every node at once just resets the slabs. Slabs never
+// move, so an index stays valid for the node's whole life. A slot is constructed the first
+// time it is handed out and reused by assignment after that. The first slabs may instead
+// be adopted from memory the pool does not own (a mapped snapshot).
+template <typename Key, typename Allocator>
+class NodePool {
+private:
+    typedef AVLNode<Key> Node;
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Node> NodeAllocator;
+    typedef std::allocator_traits<NodeAllocator> Traits;
+
+    static const int SLAB_BITS = 12;
+    static const int SLAB_SIZE = 1 << SLAB_BITS;
+    static const size_t MAX_SLABS = 1 << 15; // 128M nodes
+    NodeAllocator allocator;
+    std::vector<Node*> slabs;
+    size_t adoptedSlabs; // Leading slabs that belong to adopted memory, not to the allocator
+    int used;     // Nodes handed out from the last slab
+    int freeList; // Freed nodes, chained through their left index
+
+    // Runs the destructors of every slot constructed in slabs [firstSlab, end)
+    void destroySlots(size_t firstSlab) {
+        if (std::is_trivially_destructible<Key>::value) return;
+        for (size_t i = firstSlab; i < slabs.size(); ++i) {
+            int count = i + 1 == slabs.size() ? used : SLAB_SIZE;
+            for (int j = 0; j < count; ++j)
+                slabs[i][j].~Node();
+        }
+    }
+
+    void addSentinel() {
+        allocate(Key()); // Index 0: the empty sentinel
+        get(0).height = 0;
+        get(0).size = 0;
+    }
+
+    // Slabs the allocator handed out, from firstSlab on
+    void deallocateSlabs(size_t firstSlab) {
+        for (size_t i = std::max(firstSlab, adoptedSlabs); i < slabs.size(); ++i)
+            Traits::deallocate(allocator, slabs[i], SLAB_SIZE);
+    }
+
+public:
+    explicit NodePool(const Allocator& source) : allocator(source), adoptedSlabs(0), used(SLAB_SIZE), freeList(0) {
+        addSentinel();
+    }
+
+    ~NodePool() {
+        destroySlots(0);
+        deallocateSlabs(0);
+    }
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    int allocate(const Key& key) {
+        int index;
+        if (freeList) {
+            index = freeList;
+            freeList = get(index).left;
+            get(index).key = key;
+        }
+        else {
+            if (used == SLAB_SIZE) {
+                if (slabs.size() == MAX_SLABS) throw std::bad_alloc();
+                slabs.push_back(Traits::allocate(allocator, SLAB_SIZE));
+                used = 0;
+            }
+            index = (static_cast<int>(slabs.size()) - 1) * SLAB_SIZE + used;
+            ::new (static_cast<void*>(&get(index))) Node{ key, 0, 0, 0, 0, 0, 0 };
+            used++;
+        }
+        Node& node = get(index);
+        node.height = 1;
+        node.flags = Node::DIRTY; // New to whoever tracks changes
+        node.size = 1;
+        node.left = 0;
+        node.right = 0;
+        node.refs = 1;
+        return index;
+    }
+
+    void free(int index) {
+        Node& node = get(index);
+        if (!std::is_trivially_destructible<Key>::value) node.key = Key(); // Let go of what the key owns now
+        node.left = freeList;
+        freeList = index;
+    }
+
+    // With trivially destructible keys the slabs are dropped without visiting a node. The
+    // first slab (holding the sentinel) is kept so refilling the tree does not go back to
+    // the heap straight away.
+    void reset() {
+        if (adoptedSlabs) {
+            // Adopted memory goes back to its owner; start over from an empty pool
+            deallocateSlabs(0);
+            slabs.clear();
+            adoptedSlabs = 0;
+            used = SLAB_SIZE;
+            freeList = 0;
+            addSentinel();
+            return;
+        }
+        destroySlots(1);
+        deallocateSlabs(1);
+        if (!std::is_trivially_destructible<Key>::value) {
+            int count = slabs.size() == 1 ? used : SLAB_SIZE;
+            for (int j = 1; j < count; ++j)
+                slabs[0][j].~Node();
+        }
+        slabs.resize(1);
+        used = 1;
+        freeList = 0;
+    }
+
+    // Drops every node and takes nodes[0, count) as indices 0 to count - 1, in place (index
+    // 0 must be a sentinel). New nodes come from fresh slabs after them. The memory must
+    // stay valid and writable until the next reset() or the pool's end.
+    void adopt(Node* nodes, int count) {
+        destroySlots(0);
+        deallocateSlabs(0);
+        slabs.clear();
+        for (int first = 0; first < count; first += SLAB_SIZE)
+            slabs.push_back(nodes + first);
+        adoptedSlabs = slabs.size();
+        used = SLAB_SIZE; // The tail of the last adopted slab may lie past the end of the memory
+        freeList = 0;
+    }
+
+    // Reserves the whole slab table (256 KB of pointers), so it never moves again while
+    // other threads read through it: ReadGuards, or the tasks of a parallel set operation.
+    // Other trees never need this.
+    void pinTable() { slabs.reserve(MAX_SLABS); }
+    static size_t maxNodes() { return MAX_SLABS * SLAB_SIZE; }
+    int capacity() const { return static_cast<int>(slabs.size()) * SLAB_SIZE; }
+    Node& get(int index) { return slabs[index >> SLAB_BITS][index & (SLAB_SIZE - 1)]; }
+    const Node& get(int index) const { return slabs[index >> SLAB_BITS][index & (SLAB_SIZE - 1)]; }
+};
+
+enum class SetOperation { UNION, INTERSECTION, DIFFERENCE };
+
+// Rebalancing case met at one level of an insert's climb, as reported to a tracer
+enum class Rebalance { NONE, RIGHT, LEFT, LEFT_RIGHT, RIGHT_LEFT };
+
+// Tracing policy for insert. A tracer is told each step down and each level of the climb
+// back up; with NoTrace all of it compiles away, leaving the plain AVL algorithm. line()
+// serves owners that trace walks of their own the same way.
+struct NoTrace {
+    static const bool ENABLED = false;
+    void line(int) {}
+    void descend(bool) {}
+    void create() {}
+    void climb(Rebalance) {}
+};
+
+// Called as nodes come and go, so an owner can keep per-node data in arrays indexed like
+// the pool. created also gets the node a copy was made from (0 for a fresh node). Both
+// run under the pool lock while set operations use several threads.
+struct NoNodeHooks {
+    void created(int, int) {}
+    void destroyed(int) {}
+};
+
+// Start of a binary snapshot file (AVLCore::writeBinary). The nodes follow at offset
+// HEADER_BYTES exactly as AVLNode<Key> lays them out in memory, numbered in preorder, so a
+// mapped file can serve as the node pool without being parsed. Files only load on a
+// machine with the same byte order and node layout.
+struct AVLSnapshotHeader {
+    static const unsigned VERSION = 1;
+    static const unsigned ORDER_MARK = 0x01020304; // Reads differently under the other byte order
+    static const size_t HEADER_BYTES = 64; // Node 0 starts here, aligned for any ordinary key
+
+    char magic[8];          // "AVLSNAP"
+    unsigned version;
+    unsigned orderMark;
+    unsigned keyBytes;      // sizeof(Key)
+    unsigned nodeBytes;     // sizeof(AVLNode<Key>)
+    int nodes;              // Including the sentinel at index 0
+    int root;               // 1, or 0 for an empty tree
+};
+
+// Persistent AVL tree: nodes are shared between versions and copied on write, so a version
+// kept with snapshot() stays valid while the tree moves on.
+template <typename Key, typename Compare = std::less<Key>, typename Allocator = std::allocator<Key>, typename Hooks = NoNodeHooks>
+class AVLCore {
+public:
+    typedef AVLNode<Key> Node;
+    // AVL height is below 1.45 log2(n + 2), so 64 levels outlast any pool an int can index
+    static const int MAX_HEIGHT = 64;
+
+    // In-order cursor holding the root-to-node path in a fixed stack, so stepping never
+    // allocates. Any change to the tree invalidates it.
+    class Iterator {
+    public:
+        bool valid() const { return depth > 0; }
+        int node() const { return stack[depth - 1]; }
+        const Key& key() const { return tree->at(node()).key; }
+
+        // Successor: leftmost node of the right subtree, or else the nearest ancestor we are left of
+        void next() {
+            int child = tree->at(node()).right;
+            if (child) {
+                while (child) {
+                    push(child);
+                    child = tree->at(child).left;
+                }
+                return;
+            }
+            child = stack[--depth];
+            while (depth && tree->at(stack[depth - 1]).right == child)
+                child = stack[--depth];
+        }
+
+        // Mirror image of next()
+        void prev() {
+            int child = tree->at(node()).left;
+            if (child) {
+                while (child) {
+                    push(child);
+                    child = tree->at(child).right;
+                }
+                return;
+            }
+            child = stack[--depth];
+            while (depth && tree->at(stack[depth - 1]).left == child)
+                child = stack[--depth];
+        }
+
+    private:
+        friend class AVLCore;
+        explicit Iterator(const AVLCore* owner) : tree(owner), depth(0) {}
+        void push(int node) { stack[depth++] = node; }
+        const AVLCore* tree;
+        int stack[MAX_HEIGHT];
+        int depth;
+    };
+
+    // Remembered root-to-node path for searching near the previous key. Searches with a
+    // finger climb only as far as the subtree that must hold the new key and descend from
+    // there, so clustered or nearly sorted keys pay for the few levels that differ (the
+    // levels above are still read, but they were just read and sit in cache). A finger is
+    // owned by the caller; any change to the tree made without it, or a snapshot() or
+    // publish() (which share its path), makes it stale, and a stale finger simply starts
+    // from the root.
+    class Finger {
+    public:
+        Finger() : depth(0), owned(0), stamp(0) {}
+
+    private:
+        friend class AVLCore;
+        int path[MAX_HEIGHT];
+        bool wentLeft[MAX_HEIGHT]; // Turn taken below path[i]
+        // Levels of the nearest ancestors whose keys bound path[i]'s subtree from below and
+        // above (-1 for none). Levels rather than nodes, since path copying renumbers nodes.
+        int low[MAX_HEIGHT];
+        int high[MAX_HEIGHT];
+        int depth;
+        // Levels from the root this finger's last insert left copied for the current version.
+        // While the stamp holds, the next insert need not check them again.
+        int owned;
+        unsigned stamp; // The tree's change count when the path was taken
+    };
+
+    // Lock-free read access from other threads, RCU style. The writer calls publish() after
+    // its changes; a guard pins the version published when it was made and reads it while
+    // the writer carries on (path copying never touches a node another version holds). The
+    // writer only releases a replaced version once no guard can still be inside it, so keep
+    // guards short-lived, and let them all go before clear() or destroying the tree.
+    class ReadGuard {
+    public:
+        explicit ReadGuard(const AVLCore& owner);
+        ~ReadGuard() { tree.readers[slot].epoch.store(0); }
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        int getSize() const { return version ? tree.at(version).size : 0; }
+        bool contains(const Key& key) const { return tree.findFrom(version, key) != 0; }
+        template <typename Callback> int rangeScan(const Key& lo, const Key& hi, Callback callback) const;
+
+    private:
+        const AVLCore& tree;
+        int slot;
+        int version;
+    };
+
+    explicit AVLCore(const Compare& compare = Compare(), const Allocator& allocator = Allocator(), const Hooks& hooks = Hooks())
+        : pool(allocator), hooks(hooks), less(compare), concurrent(false), relaxed(false), root(0), changes(1),
+          published(0), epoch(1) {}
+    // The pool frees every version's nodes with its slabs (no ReadGuard may be left)
+    ~AVLCore() {}
+
+    AVLCore(const AVLCore&) = delete;
+    AVLCore& operator=(const AVLCore&) = delete;
+
+    // Read access for owners that walk the tree themselves (layout, drawing)
+    int getRoot() const { return root; }
+    int getSize() const { return at(root).size; }
+    const Node& node(int index) const { return at(index); }
+    unsigned char& flags(int index) { return at(index).flags; }
+    int capacity() const { return pool.capacity(); }
+
+    template <typename Tracer> bool insert(const Key& key, Tracer& tracer, Finger& finger);
+    template <typename Tracer> bool insert(const Key& key, Tracer& tracer) {
+        Finger finger;
+        return insert(key, tracer, finger);
+    }
+    bool insert(const Key& key, Finger& finger) {
+        NoTrace tracer;
+        return insert(key, tracer, finger);
+    }
+    bool insert(const Key& key) {
+        NoTrace tracer;
+        Finger finger;
+        return insert(key, tracer, finger);
+    }
+    bool erase(const Key& key);
+    int find(const Key& key) const { return findFrom(root, key); }
+    bool contains(const Key& key) const { return frozen.empty() ? find(key) != 0 : frozenContains(key); }
+    // Node holding key, or 0, searching from the finger and leaving it at the key (or at
+    // the node the key would hang from)
+    int find(const Key& key, Finger& finger) const { return descend(key, finger); }
+    bool contains(const Key& key, Finger& finger) const { return descend(key, finger) != 0; }
+    void searchBatch(const Key* keys, int count, bool* found) const;
+
+    int countBelow(const Key& key, bool inclusive, std::vector<int>* path = nullptr) const;
+    int select(int k, std::vector<int>* path = nullptr) const;
+    int countRange(const Key& lo, const Key& hi, std::vector<int>* path = nullptr) const;
+
+    Iterator begin() const;
+    Iterator last() const;
+    Iterator lowerBound(const Key& key) const { return lowerBoundFrom(root, key); }
+    template <typename Callback> int rangeScan(const Key& lo, const Key& hi, Callback callback) const;
+
+    void assign(std::vector<Key>& keys);
+    void combine(SetOperation operation, std::vector<Key>& keys);
+    void combine(SetOperation operation, const AVLCore& other);
+    // Insert or erase many keys at once: the batch is sorted and merged into the tree by
+    // union or difference, O(m log(n/m + 1)) for m keys. Returns how many keys were added or removed.
+    int insertBatch(std::vector<Key>& keys) {
+        int before = getSize();
+        combine(SetOperation::UNION, keys);
+        return getSize() - before;
+    }
+    int eraseBatch(std::vector<Key>& keys) {
+        int before = getSize();
+        combine(SetOperation::DIFFERENCE, keys);
+        return before - getSize();
+    }
+    void clear();
+
+    // Relaxed balance: while on, insert never rotates. It marks subtrees left out of balance
+    // as pending and stops climbing at the first node already marked, leaving the heights
+    // above stale (sizes stay exact); settle() restores the AVL invariant for all of them
+    // in one pass. A key that continues a sorted run adopts the run as its subtree, so
+    // keys arriving in order build balanced subtrees as they come. Every other change
+    // settles first, and an insert that would leave a leaf deeper than relaxedDepth()
+    // settles early. Turning it off settles. Sorted bursts measure about twice as fast as
+    // strict inserts; random keys measure slower, since every descent crosses the deeper
+    // unbalanced levels. Keys already in hand should go through assign() or insertBatch().
+    void setRelaxed(bool on) {
+        relaxed = on;
+        if (!on) settle();
+    }
+    bool isRelaxed() const { return relaxed; }
+    bool hasPending() const { return (at(root).flags & Node::PENDING) != 0; }
+    void settle();
+    // Recomputes the heights relaxed inserts left stale (only pending nodes have them),
+    // without rotating. Layout and writeBinary() need exact heights.
+    void refresh() { refreshHeight(root); }
+    int pendingCount() const { // Nodes out of balance right now
+        int height;
+        return countPending(root, height);
+    }
+    bool isBalanced() const { return checkedHeight(root) >= 0; } // Full O(n) check of heights, sizes and balance
+
+    // For read-heavy phases: copies the keys into one array in Eytzinger (breadth-first)
+    // order, which contains() then searches instead of the nodes. The next change to the
+    // tree drops the copy again.
+    void freeze();
+    bool isFrozen() const { return !frozen.empty(); }
+
+    // Versions: snapshot() keeps the current tree and returns a handle to it, exchange()
+    // makes a handle current and hands back the previous tree as a handle, release() drops one
+    int snapshot() {
+        changes++; // The root is shared from here on, so fingers must copy their paths again
+        return retain(root);
+    }
+    int exchange(int version) {
+        changed();
+        int previous = root;
+        root = version;
+        return previous;
+    }
+    void release(int version);
+    // Makes the current tree the one new ReadGuards see, and releases the versions replaced
+    // earlier that no guard is reading any more. Writer thread only.
+    void publish();
+
+    // Binary snapshots (keys must be trivially copyable). writeBinary() saves the current
+    // tree. adoptBinary() replaces everything (every version included) with the tree in a
+    // snapshot held in memory, normally a copy-on-write mapping of the file: the nodes are
+    // used in place, with no parsing and no allocation. The header and every node are
+    // checked first, and a snapshot that fails leaves the tree as it was. The memory must
+    // stay valid and writable until clear() or the tree's end. Hooks are not told about
+    // adopted nodes; owners size their per-node data from capacity().
+    bool writeBinary(FILE* file);
+    bool adoptBinary(void* data, size_t bytes);
+
+private:
+    // Set operations only fork when both inputs together hold at least this many keys
+    static const int PARALLEL_GRAIN = 1 << 14;
+    // Descents searchBatch keeps in flight, enough to cover a memory access with work
+    static const int BATCH_LANES = 16;
+
+    NodePool<Key, Allocator> pool; // Shared by the live tree and every version
+    Hooks hooks;
+    Compare less;
+    std::mutex poolMutex; // Guards the pool (and hooks) while set operations run in parallel
+    bool concurrent;
+    bool relaxed;
+    int root;
+    // Keys in Eytzinger order from index 1 (children of k at 2k and 2k + 1), empty unless
+    // frozen. A cache line holds FROZEN_LINE keys, so prefetching index 16k while at k (for
+    // int keys) brings in all of k's descendants four levels down in one or two lines.
+    std::vector<Key> frozen;
+    static const size_t FROZEN_LINE = sizeof(Key) < 64 ? 64 / sizeof(Key) : 1;
+    unsigned changes; // Bumped by every change, so a finger can tell it is out of date
+    // Epoch-based reclamation for ReadGuards. Each guard holds a slot (on its own cache line)
+    // set to the epoch it started in, 0 while free. publish() moves to a new epoch and
+    // retires the previous version tagged with it; a retired version is released once every
+    // busy slot shows that epoch or a later one.
+    static const int MAX_READERS = 64;
+    struct alignas(64) ReaderSlot {
+        std::atomic<unsigned> epoch;
+        ReaderSlot() : epoch(0) {}
+    };
+    mutable ReaderSlot readers[MAX_READERS];
+    std::atomic<int> published; // Version new guards read (0 until the first publish)
+    std::atomic<unsigned> epoch;
+    std::vector<std::pair<int, unsigned> > retired; // Replaced versions and the epoch they were retired in
+
+    Node& at(int node) { return pool.get(node); }
+    const Node& at(int node) const { return pool.get(node); }
+    int newNode(const Key& key, int copiedFrom = 0);
+    void freeNode(int node);
+    int retain(int node) {
+        if (node) at(node).refs++;
+        return node;
+    }
+    int copyNode(int node);
+    int own(int node);
+    int getHeight(int node) const { return at(node).height; }
+    int getBalance(int node) const { return node ? getHeight(at(node).left) - getHeight(at(node).right) : 0; }
+    void updateHeight(int node);
+    int rightRotate(int y);
+    int leftRotate(int x);
+    void relink(const int* path, const bool* wentLeft, int level, int child);
+    void ownPath(int* path, const bool* wentLeft, int depth, int from = 0);
+    int buildBalanced(const std::vector<Key>& keys, int lo, int hi);
+    void sortUnique(std::vector<Key>& keys) const;
+    // Called before any change to the current tree: drops the frozen copy and makes every
+    // finger taken so far stale
+    void changed() {
+        frozen.clear();
+        changes++;
+    }
+    int findFrom(int top, const Key& key) const;
+    Iterator lowerBoundFrom(int top, const Key& key) const;
+    unsigned oldestReader() const;
+    bool fingerCovers(const Finger& finger, int level, const Key& key) const;
+    int descend(const Key& key, Finger& finger) const;
+    void fillFrozen(size_t index, Iterator& it);
+    bool frozenContains(const Key& key) const;
+    void frozenBatch(const Key* keys, int count, bool* found) const;
+    int makeNode(int left, const Key& key, int right);
+    void expose(int tree, int& left, Key& key, int& right);
+    int rebalance(int node);
+    // Deepest leaf a relaxed insert may add: twice the AVL worst case for the current size,
+    // so deferring never more than doubles a search
+    int relaxedDepth() const {
+        int depth = 2;
+        for (int n = getSize(); n > 0; n >>= 1) depth += 3;
+        return depth < MAX_HEIGHT - 1 ? depth : MAX_HEIGHT - 1;
+    }
+    void markPending(int node);
+    int sortedRun(const int* path, const bool* wentLeft, int depth) const;
+    int refreshHeight(int node);
+    int settleSubtree(int node);
+    int restore(int node);
+    int countPending(int node, int& height) const;
+    int checkedHeight(int node) const;
+    int joinRight(int left, const Key& key, int right);
+    int joinLeft(int left, const Key& key, int right);
+    int join(int left, const Key& key, int right);
+    int join2(int left, int right);
+    int splitLast(int tree, Key& lastKey);
+    void split(int tree, const Key& key, int& left, bool& found, int& right);
+    int setOperation(SetOperation operation, int a, int b, int forks);
+    bool validBinary(const Node* nodes, int count) const;
+};
+
+// Shorthand for the out-of-class definitions below
+#define AVL_CORE_TEMPLATE template <typename Key, typename Compare, typename Allocator, typename Hooks>
+#define AVL_CORE AVLCore<Key, Compare, Allocator, Hooks>
+
+// copiedFrom is the node a copy is made from (0 for a fresh node). Locked while set
+// operations run on several threads, since the pool is shared.
+AVL_CORE_TEMPLATE
+int AVL_CORE::newNode(const Key& key, int copiedFrom) {
+    std::unique_lock<std::mutex> lock(poolMutex, std::defer_lock);
+    if (concurrent) lock.lock();
+    int node = pool.allocate(key);
+    hooks.created(node, copiedFrom);
+    return node;
+}
+
+AVL_CORE_TEMPLATE
+void AVL_CORE::freeNode(int node) {
+    std::unique_lock<std::mutex> lock(poolMutex, std::defer_lock);
+    if (concurrent) lock.lock();
+    hooks.destroyed(node);
+    pool.free(node);
+}
+
+// Versions share subtrees, so a node is only freed once the last parent or version
+// referencing it lets go. Iterative so releasing a large tree cannot overflow the stack;
+// the walk only holds nodes whose count reached zero, at most one waiting sibling per
+// level, so a fixed stack does and nothing is allocated.
+AVL_CORE_TEMPLATE
+void AVL_CORE::release(int node) {
+    if (!node || --at(node).refs > 0) return;
+    int stack[MAX_HEIGHT + 1];
+    int depth = 0;
+    stack[depth++] = node;
+    while (depth) {
+        int current = stack[--depth];
+        const Node& n = at(current);
+        if (n.left && --at(n.left).refs == 0) stack[depth++] = n.left;
+        if (n.right && --at(n.right).refs == 0) stack[depth++] = n.right;
+        freeNode(current);
+    }
+}
+
+// Claims a free slot in the current epoch before reading the published root. Publishing
+// stores the root before moving to the next epoch, so a guard either sees the new root or
+// holds an epoch that keeps the version it did see from being released.
+AVL_CORE_TEMPLATE
+AVL_CORE::ReadGuard::ReadGuard(const AVLCore& owner) : tree(owner), slot(0) {
+    for (;;) {
+        unsigned expected = 0;
+        if (tree.readers[slot].epoch.compare_exchange_strong(expected, tree.epoch.load())) break;
+        if (++slot == MAX_READERS) {
+            slot = 0;
+            std::this_thread::yield(); // Every slot is busy
+        }
+    }
+    version = tree.published.load();
+}
+
+// Epoch of the longest-running guard, or the maximum when there are none
+AVL_CORE_TEMPLATE
+unsigned AVL_CORE::oldestReader() const {
+    unsigned oldest = std::numeric_limits<unsigned>::max();
+    for (int i = 0; i < MAX_READERS; ++i) {
+        unsigned started = readers[i].epoch.load();
+        if (started && started < oldest) oldest = started;
+    }
+    return oldest;
+}
+
+// The first publish pins the slab table; until then no guard reads the pool, since
+// version 0 is answered without it
+AVL_CORE_TEMPLATE
+void AVL_CORE::publish() {
+    pool.pinTable();
+    changes++; // Shares the root, like snapshot()
+    int previous = published.load();
+    published.store(retain(root));
+    if (previous) retired.push_back(std::make_pair(previous, ++epoch));
+    unsigned oldest = oldestReader();
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); ++i) {
+        if (retired[i].second <= oldest) release(retired[i].first);
+        else retired[kept++] = retired[i];
+    }
+    retired.resize(kept);
+}
+
+AVL_CORE_TEMPLATE
+int AVL_CORE::copyNode(int node) {
+    int copy = newNode(at(node).key, node);
+    Node& n = at(copy);
+    const Node& original = at(node);
+    n.height = original.height;
+    n.size = original.size;
+    n.left = retain(original.left);
+    n.right = retain(original.right);
+    n.flags |= original.flags & Node::PENDING;
+    return copy;
+}
+
+// Path copying: called on the link we are about to modify, walking down from an owned
+// parent. A node shared with another version is replaced by a private copy; a node only
+// reachable through us is modified in place.
+AVL_CORE_TEMPLATE
+int AVL_CORE::own(int node) {
+    if (!node || at(node).refs == 1) return node;
+    at(node).refs--;
+    return copyNode(node);
+}
+
+// Also refreshes the subtree size, so rotations keep rank/select data correct
+AVL_CORE_TEMPLATE
+void AVL_CORE::updateHeight(int node) {
+    if (node) {
+        Node& n = at(node);
+        n.height = static_cast<unsigned char>(1 + std::max(getHeight(n.left), getHeight(n.right)));
+        n.size = 1 + at(n.left).size + at(n.right).size;
+        n.flags |= Node::DIRTY;
+    }
+}
+
+// y must already be owned by the caller; the child lifted above it is owned here
+AVL_CORE_TEMPLATE
+int AVL_CORE::rightRotate(int y) {
+    int x = own(at(y).left);
+    int T2 = at(x).right;
+
+    at(x).right = y;
+    at(y).left = T2;
+
+    updateHeight(y);
+    updateHeight(x);
+
+    return x;
+}
+
+AVL_CORE_TEMPLATE
+int AVL_CORE::leftRotate(int x) {
+    int y = own(at(x).right);
+    int T2 = at(y).left;
+
+    at(y).left = x;
+    at(x).right = T2;
+
+    updateHeight(x);
+    updateHeight(y);
+
+    return y;
+}
+
+// Points the parent of path[level] (or the root) at child
+AVL_CORE_TEMPLATE
+void AVL_CORE::relink(const int* path, const bool* wentLeft, int level, int child) {
+    if (level == 0)
+        root = child;
+    else if (wentLeft[level - 1])
+        at(path[level - 1]).left = child;
+    else
+        at(path[level - 1]).right = child;
+}
+
+// Takes ownership of path[from, depth) from the top down, so shared nodes get copied
+// before anything below them is modified. The levels above from must already be owned.
+AVL_CORE_TEMPLATE
+void AVL_CORE::ownPath(int* path, const bool* wentLeft, int depth, int from) {
+    for (int i = from; i < depth; ++i) {
+        path[i] = own(path[i]);
+        relink(path, wentLeft, i, path[i]);
+    }
+}
+
+// Whether key belongs in the subtree at the given level of the finger
+AVL_CORE_TEMPLATE
+bool AVL_CORE::fingerCovers(const Finger& finger, int level, const Key& key) const {
+    int low = finger.low[level];
+    int high = finger.high[level];
+    return (low < 0 || less(at(finger.path[low]).key, key)) && (high < 0 || less(key, at(finger.path[high]).key));
+}
+
+// Moves the finger to key, returning its node, or to the last node on the way to where
+// key would be (returning 0). The path then ends at that node.
+AVL_CORE_TEMPLATE
+int AVL_CORE::descend(const Key& key, Finger& finger) const {
+    int level = 0;
+    if (finger.stamp == changes && finger.depth > 0) {
+        level = finger.depth - 1;
+        while (level > 0 && !fingerCovers(finger, level, key)) level--;
+        finger.owned = std::min(finger.owned, level + 1);
+    }
+    else {
+        finger.path[0] = root;
+        finger.low[0] = -1;
+        finger.high[0] = -1;
+        finger.owned = 0;
+    }
+    finger.stamp = changes;
+    finger.depth = 0;
+    if (!root) return 0;
+
+    while (true) {
+        int node = finger.path[level];
+        const Node& n = at(node);
+        bool goLeft = less(key, n.key);
+        finger.depth = level + 1;
+        if (!goLeft && !less(n.key, key)) return node;
+        finger.wentLeft[level] = goLeft;
+        int child = goLeft ? n.left : n.right;
+        if (!child) return 0;
+        finger.low[level + 1] = goLeft ? finger.low[level] : level;
+        finger.high[level + 1] = goLeft ? level : finger.high[level];
+        finger.path[++level] = child;
+    }
+}
+
+// Descends from the finger into its fixed-size path, then climbs back up, rebalancing, and
+// stops as soon as a subtree comes out with its old height. Returns false on a duplicate.
+// The tracer hears every step the recursive textbook insert would take from the root.
+// Afterwards the finger points at the new node, or at the subtree a rotation put in its place.
+AVL_CORE_TEMPLATE
+template <typename Tracer>
+bool AVL_CORE::insert(const Key& key, Tracer& tracer, Finger& finger) {
+    if (!relaxed) settle();
+    int found = descend(key, finger);
+    if (!found && relaxed && finger.depth >= relaxedDepth()) {
+        // Searches are getting too long (or there is no room for a deeper leaf): do the
+        // deferred rebalancing now
+        settle();
+        found = descend(key, finger);
+    }
+    int* path = finger.path;
+    bool* wentLeft = finger.wentLeft;
+    int depth = finger.depth;
+    if (Tracer::ENABLED) {
+        for (int i = 0; i < (found ? depth - 1 : depth); ++i)
+            tracer.descend(wentLeft[i]);
+    }
+    if (found) return false;
+    tracer.create();
+    changed();
+
+    ownPath(path, wentLeft, depth, finger.owned);
+    int created = newNode(key);
+    int top = relaxed ? sortedRun(path, wentLeft, depth) : depth;
+    if (top < depth) {
+        // The new key continues a sorted run: it takes the run's place and the run, now
+        // complete, becomes its subtree
+        for (int i = depth - 1; i >= top; --i) {
+            updateHeight(path[i]);
+            at(path[i]).flags &= ~Node::PENDING;
+            if (Tracer::ENABLED) tracer.climb(Rebalance::NONE);
+        }
+        if (wentLeft[depth - 1])
+            at(created).right = path[top];
+        else
+            at(created).left = path[top];
+        updateHeight(created);
+        // Marked even when the run is short: the next keys extend the run below it
+        at(created).flags |= Node::PENDING;
+    }
+    else if (depth) {
+        finger.low[depth] = wentLeft[depth - 1] ? finger.low[depth - 1] : depth - 1;
+        finger.high[depth] = wentLeft[depth - 1] ? depth - 1 : finger.high[depth - 1];
+    }
+    relink(path, wentLeft, top, created);
+    path[top] = created;
+    finger.depth = top + 1;
+    finger.stamp = changes;
+
+    int level = top - 1;
+    for (; level >= 0; --level) {
+        int node = path[level];
+        if (relaxed && (at(node).flags & Node::PENDING)) {
+            // Already marked, and so is everything above it. settle() and refresh() recompute
+            // those heights, so they are left stale and the climb stops here: a burst of
+            // inserts into one pending region costs O(1) per key above the sizes.
+            break;
+        }
+        int oldHeight = at(node).height;
+        unsigned char oldPending = at(node).flags & Node::PENDING;
+        updateHeight(node);
+        int balance = getBalance(node);
+
+        Rebalance rebalance = Rebalance::NONE;
+        int subtree = node;
+        if (relaxed) {
+            // No rotations; the mark leads settle() here later
+            markPending(node);
+        }
+        else if (balance > 1 && less(key, at(at(node).left).key)) {
+            rebalance = Rebalance::RIGHT;
+            subtree = rightRotate(node);
+        }
+        else if (balance < -1 && less(at(at(node).right).key, key)) {
+            rebalance = Rebalance::LEFT;
+            subtree = leftRotate(node);
+        }
+        else if (balance > 1) {
+            rebalance = Rebalance::LEFT_RIGHT;
+            at(node).left = leftRotate(at(node).left);
+            subtree = rightRotate(node);
+        }
+        else if (balance < -1) {
+            rebalance = Rebalance::RIGHT_LEFT;
+            at(node).right = rightRotate(at(node).right);
+            subtree = leftRotate(node);
+        }
+        tracer.climb(rebalance);
+        if (subtree != node) {
+            relink(path, wentLeft, level, subtree);
+            // The rotated levels below are reshuffled; the subtree keeps its key range
+            path[level] = subtree;
+            finger.depth = level + 1;
+        }
+
+        if (at(subtree).height == oldHeight && (at(subtree).flags & Node::PENDING) == oldPending) {
+            // No height or pending mark above changes, only the sizes; the recursion would
+            // just return through these levels
+            level--;
+            break;
+        }
+    }
+    for (int j = 0; j <= level; ++j) {
+        at(path[j]).size++;
+        at(path[j]).flags |= Node::DIRTY;
+        if (Tracer::ENABLED) tracer.climb(Rebalance::NONE);
+    }
+    finger.owned = finger.depth;
+    return true;
+}
+
+// Same shape as insert: descend, unlink (a node with two children takes its in-order
+// successor's key and the successor is unlinked instead), then climb until heights settle.
+AVL_CORE_TEMPLATE
+bool AVL_CORE::erase(const Key& key) {
+    int path[MAX_HEIGHT];
+    bool wentLeft[MAX_HEIGHT];
+    settle();
+    int depth = 0;
+    int node = root;
+    while (node) {
+        bool goLeft = less(key, at(node).key);
+        if (!goLeft && !less(at(node).key, key)) break;
+        path[depth] = node;
+        wentLeft[depth] = goLeft;
+        node = goLeft ? at(node).left : at(node).right;
+        depth++;
+    }
+    if (!node) return false;
+    changed();
+
+    int target = depth;
+    if (at(node).left && at(node).right) {
+        path[depth] = node;
+        wentLeft[depth++] = false;
+        node = at(node).right;
+        while (at(node).left) {
+            path[depth] = node;
+            wentLeft[depth++] = true;
+            node = at(node).left;
+        }
+    }
+
+    ownPath(path, wentLeft, depth);
+    if (target < depth) at(path[target]).key = at(node).key;
+    // The unlinked node drops out of this version; other versions may still hold it
+    int replacement = retain(at(node).left ? at(node).left : at(node).right);
+    release(node);
+    relink(path, wentLeft, depth, replacement);
+
+    for (int i = depth - 1; i >= 0; --i) {
+        int current = path[i];
+        int oldHeight = at(current).height;
+        int subtree = rebalance(current);
+        if (subtree != current) relink(path, wentLeft, i, subtree);
+        if (at(subtree).height == oldHeight) {
+            for (int j = 0; j < i; ++j) {
+                at(path[j]).size--;
+                at(path[j]).flags |= Node::DIRTY;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+// A relaxed insert of the successor of a leaf (or the predecessor, mirrored) looks up the
+// path for the run it continues: the leaf, then each ancestor it hangs right of that an
+// earlier run key left pending, as long as that ancestor's left subtree is settled and no
+// more than one level off the run below. The new key can adopt the whole run as its left
+// subtree, an AVL tree once its heights are redone. Keys coming in order then build
+// perfect subtrees the way a sorted-array build would, about two levels per key, instead
+// of a chain for settle() to rotate apart. Returns the level of the run's top, or depth
+// if the key just hangs from its leaf.
+AVL_CORE_TEMPLATE
+int AVL_CORE::sortedRun(const int* path, const bool* wentLeft, int depth) const {
+    if (!depth) return depth;
+    bool left = wentLeft[depth - 1];
+    const Node& leaf = at(path[depth - 1]);
+    if (left ? leaf.right : leaf.left) return depth;
+    int top = depth - 1;
+    int height = 1;
+    while (top > 0 && wentLeft[top - 1] == left) {
+        const Node& above = at(path[top - 1]);
+        int side = left ? above.right : above.left;
+        int sideHeight = getHeight(side);
+        if (!(above.flags & Node::PENDING) || (at(side).flags & Node::PENDING) || sideHeight > height + 1
+            || sideHeight < height - 1)
+            break;
+        height = 1 + std::max(height, sideHeight);
+        top--;
+    }
+    return top;
+}
+
+// Sets node's pending mark from its own balance and its children's marks
+AVL_CORE_TEMPLATE
+void AVL_CORE::markPending(int node) {
+    Node& n = at(node);
+    int balance = getBalance(node);
+    if (balance > 1 || balance < -1 || ((at(n.left).flags | at(n.right).flags) & Node::PENDING))
+        n.flags |= Node::PENDING;
+    else
+        n.flags &= ~Node::PENDING;
+}
+
+// Relaxed inserts stop climbing at the first pending node, so only pending nodes can hold
+// a stale height. Fixed in place: a height describes the subtree, so every version sharing
+// the node agrees on it, and ReadGuards never read heights.
+AVL_CORE_TEMPLATE
+int AVL_CORE::refreshHeight(int node) {
+    Node& n = at(node);
+    if (!(n.flags & Node::PENDING)) return n.height;
+    int height = 1 + std::max(refreshHeight(n.left), refreshHeight(n.right));
+    if (n.height != height) {
+        n.height = static_cast<unsigned char>(height);
+        n.flags |= Node::DIRTY;
+    }
+    return height;
+}
+
+AVL_CORE_TEMPLATE
+void AVL_CORE::settle() {
+    if (!hasPending()) return;
+    changed();
+    root = settleSubtree(root);
+}
+
+// Settles the children first, so only subtrees marked pending are visited and restore()
+// always works on a node whose children are AVL trees
+AVL_CORE_TEMPLATE
+int AVL_CORE::settleSubtree(int node) {
+    if (!(at(node).flags & Node::PENDING)) return node;
+    node = own(node);
+    at(node).left = settleSubtree(at(node).left);
+    at(node).right = settleSubtree(at(node).right);
+    at(node).flags &= ~Node::PENDING;
+    return restore(node);
+}
+
+// Balances a node whose children are AVL trees but may differ in height by any amount. A
+// difference of two is the usual single or double rotation. A larger one rotates the tall
+// side up and restores the node it demoted, which brings the new top within two; this is
+// O(difference), like a join.
+AVL_CORE_TEMPLATE
+int AVL_CORE::restore(int node) {
+    updateHeight(node);
+    int balance = getBalance(node);
+    if (balance >= -2 && balance <= 2) return rebalance(node);
+    int top;
+    if (balance > 0) {
+        top = rightRotate(node);
+        at(top).right = restore(at(top).right);
+    }
+    else {
+        top = leftRotate(node);
+        at(top).left = restore(at(top).left);
+    }
+    return restore(top);
+}
+
+// Works from true heights, since a pending node's stored one may be stale
+AVL_CORE_TEMPLATE
+int AVL_CORE::countPending(int node, int& height) const {
+    height = at(node).height;
+    if (!(at(node).flags & Node::PENDING)) return 0;
+    int left, right;
+    int count = countPending(at(node).left, left) + countPending(at(node).right, right);
+    height = 1 + std::max(left, right);
+    return count + (left - right > 1 || right - left > 1);
+}
+
+// Height of the subtree, or -1 if a stored height or size is wrong or a node is out of balance
+AVL_CORE_TEMPLATE
+int AVL_CORE::checkedHeight(int node) const {
+    if (!node) return 0;
+    const Node& n = at(node);
+    int left = checkedHeight(n.left);
+    int right = checkedHeight(n.right);
+    if (left < 0 || right < 0 || left - right > 1 || right - left > 1) return -1;
+    int height = 1 + std::max(left, right);
+    if (n.height != height || n.size != 1 + at(n.left).size + at(n.right).size) return -1;
+    return height;
+}
+
+// Node holding key, or 0
+AVL_CORE_TEMPLATE
+int AVL_CORE::findFrom(int top, const Key& key) const {
+    int current = top;
+    while (current) {
+        const Node& n = at(current);
+        if (less(key, n.key)) current = n.left;
+        else if (less(n.key, key)) current = n.right;
+        else break;
+    }
+    return current;
+}
+
+// found[i] = contains(keys[i]) for i in [0, count). Searches run in groups of BATCH_LANES
+// that advance one level per round, each prefetching its next node, so the misses of a
+// group overlap instead of being paid one after another as in a loop over contains().
+AVL_CORE_TEMPLATE
+void AVL_CORE::searchBatch(const Key* keys, int count, bool* found) const {
+    for (int base = 0; base < count; base += BATCH_LANES) {
+        int lanes = count - base < BATCH_LANES ? count - base : BATCH_LANES;
+        if (!frozen.empty()) {
+            frozenBatch(keys + base, lanes, found + base);
+            continue;
+        }
+        int current[BATCH_LANES];
+        for (int i = 0; i < lanes; ++i) {
+            current[i] = root;
+            found[base + i] = false;
+        }
+        bool active = root != 0;
+        while (active) {
+            active = false;
+            for (int i = 0; i < lanes; ++i) {
+                int node = current[i];
+                if (!node) continue;
+                const Node& n = at(node);
+                const Key& key = keys[base + i];
+                if (less(key, n.key)) {
+                    node = n.left;
+                }
+                else if (less(n.key, key)) {
+                    node = n.right;
+                }
+                else {
+                    found[base + i] = true;
+                    node = 0;
+                }
+                current[i] = node;
+                if (node) {
+                    AVL_PREFETCH(&at(node));
+                    active = true;
+                }
+            }
+        }
+    }
+}
+
+// Number of keys below key (or up to it when inclusive), appending the descent to path
+AVL_CORE_TEMPLATE
+int AVL_CORE::countBelow(const Key& key, bool inclusive, std::vector<int>* path) const {
+    int count = 0;
+    int node = root;
+    while (node) {
+        if (path) path->push_back(node);
+        const Node& n = at(node);
+        if (less(key, n.key)) {
+            node = n.left;
+        }
+        else if (less(n.key, key)) {
+            count += at(n.left).size + 1;
+            node = n.right;
+        }
+        else {
+            count += at(n.left).size + (inclusive ? 1 : 0);
+            break;
+        }
+    }
+    return count;
+}
+
+// Node holding the k-th smallest key (1-based), or 0 when k is out of range
+AVL_CORE_TEMPLATE
+int AVL_CORE::select(int k, std::vector<int>* path) const {
+    if (k < 1 || k > at(root).size) return 0;
+    int node = root;
+    while (node) {
+        if (path) path->push_back(node);
+        int leftSize = at(at(node).left).size;
+        if (k <= leftSize) {
+            node = at(node).left;
+        }
+        else if (k == leftSize + 1) {
+            return node;
+        }
+        else {
+            k -= leftSize + 1;
+            node = at(node).right;
+        }
+    }
+    return 0;
+}
+
+// Number of keys in [lo, hi]; path gets the descent to lo followed by the descent to hi
+AVL_CORE_TEMPLATE
+int AVL_CORE::countRange(const Key& lo, const Key& hi, std::vector<int>* path) const {
+    if (less(hi, lo)) return 0;
+    int below = countBelow(lo, false, path);
+    return countBelow(hi, true, path) - below;
+}
+
+AVL_CORE_TEMPLATE
+typename AVL_CORE::Iterator AVL_CORE::begin() const {
+    Iterator it(this);
+    for (int node = root; node; node = at(node).left)
+        it.push(node);
+    return it;
+}
+
+AVL_CORE_TEMPLATE
+typename AVL_CORE::Iterator AVL_CORE::last() const {
+    Iterator it(this);
+    for (int node = root; node; node = at(node).right)
+        it.push(node);
+    return it;
+}
+
+// First key >= key. The stack keeps the whole descent, then is cut back to the last
+// node where we turned left (or the match), which is the answer.
+AVL_CORE_TEMPLATE
+typename AVL_CORE::Iterator AVL_CORE::lowerBoundFrom(int top, const Key& key) const {
+    Iterator it(this);
+    int answerDepth = 0;
+    int node = top;
+    while (node) {
+        it.push(node);
+        const Node& n = at(node);
+        if (less(n.key, key)) {
+            node = n.right;
+            continue;
+        }
+        answerDepth = it.depth;
+        if (!less(key, n.key)) break;
+        node = n.left;
+    }
+    it.depth = answerDepth;
+    return it;
+}
+
+// Calls callback(key) for every key in [lo, hi] in ascending order and returns how many
+// there were. Subtrees left of lo are skipped on the way down, so this is O(log n + k).
+AVL_CORE_TEMPLATE
+template <typename Callback>
+int AVL_CORE::rangeScan(const Key& lo, const Key& hi, Callback callback) const {
+    int count = 0;
+    for (Iterator it = lowerBound(lo); it.valid() && !less(hi, it.key()); it.next()) {
+        callback(it.key());
+        count++;
+    }
+    return count;
+}
+
+// Same as AVLCore::rangeScan, over the guarded version
+AVL_CORE_TEMPLATE
+template <typename Callback>
+int AVL_CORE::ReadGuard::rangeScan(const Key& lo, const Key& hi, Callback callback) const {
+    int count = 0;
+    for (Iterator it = tree.lowerBoundFrom(version, lo); it.valid() && !tree.less(hi, it.key()); it.next()) {
+        callback(it.key());
+        count++;
+    }
+    return count;
+}
+
+AVL_CORE_TEMPLATE
+int AVL_CORE::buildBalanced(const std::vector<Key>& keys, int lo, int hi) {
+    if (lo >= hi) return 0;
+    int mid = lo + (hi - lo) / 2;
+    int node = newNode(keys[mid]);
+    int left = buildBalanced(keys, lo, mid);
+    int right = buildBalanced(keys, mid + 1, hi);
+    at(node).left = left;
+    at(node).right = right;
+    updateHeight(node);
+    return node;
+}
+
+// Sorts and removes duplicates. Large inputs are sorted in one chunk per hardware thread
+// and the chunks merged pairwise, also in parallel.
+AVL_CORE_TEMPLATE
+void AVL_CORE::sortUnique(std::vector<Key>& keys) const {
+    const size_t parallelThreshold = 1 << 16;
+    const Compare& compare = less;
+    size_t workers = std::thread::hardware_concurrency();
+    if (keys.size() < parallelThreshold || workers < 2) {
+        std::sort(keys.begin(), keys.end(), compare);
+    }
+    else {
+        std::vector<size_t> bounds(workers + 1);
+        for (size_t i = 0; i <= workers; ++i)
+            bounds[i] = keys.size() * i / workers;
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < workers; ++i) {
+            threads.emplace_back([&keys, &bounds, &compare, i]() {
+                std::sort(keys.begin() + bounds[i], keys.begin() + bounds[i + 1], compare);
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+
+        for (size_t width = 1; width < workers; width *= 2) {
+            threads.clear();
+            for (size_t i = 0; i + width < workers; i += 2 * width) {
+                size_t first = bounds[i];
+                size_t middle = bounds[i + width];
+                size_t last = bounds[std::min(i + 2 * width, workers)];
+                threads.emplace_back([&keys, &compare, first, middle, last]() {
+                    std::inplace_merge(keys.begin() + first, keys.begin() + middle, keys.begin() + last, compare);
+                });
+            }
+            for (std::thread& thread : threads) thread.join();
+        }
+    }
+    keys.erase(std::unique(keys.begin(), keys.end(), [&compare](const Key& a, const Key& b) {
+        return !compare(a, b) && !compare(b, a);
+    }), keys.end());
+}
+
+// Replaces the tree with the given keys (sorted in place), built balanced in O(N) after sorting
+AVL_CORE_TEMPLATE
+void AVL_CORE::assign(std::vector<Key>& keys) {
+    sortUnique(keys);
+    changed();
+    release(root);
+    root = buildBalanced(keys, 0, static_cast<int>(keys.size()));
+}
+
+// Join-based set algorithms (Blelloch, Ferizovic and Sun, "Just Join for Parallel Ordered
+// Sets"). Each function consumes the references it is handed and returns an owned root,
+// so other versions are never touched.
+
+// New node over two subtrees, taking over their references
+AVL_CORE_TEMPLATE
+int AVL_CORE::makeNode(int left, const Key& key, int right) {
+    int node = newNode(key);
+    at(node).left = left;
+    at(node).right = right;
+    updateHeight(node);
+    return node;
+}
+
+// Splits a tree into its root key and subtrees, handing our reference down to them
+AVL_CORE_TEMPLATE
+void AVL_CORE::expose(int tree, int& left, Key& key, int& right) {
+    const Node& n = at(tree);
+    left = retain(n.left);
+    key = n.key;
+    right = retain(n.right);
+    release(tree);
+}
+
+// Restores the AVL invariant at an owned node whose children differ in height by at most 2
+AVL_CORE_TEMPLATE
+int AVL_CORE::rebalance(int node) {
+    updateHeight(node);
+    int balance = getBalance(node);
+    if (balance > 1) {
+        if (getBalance(at(node).left) < 0)
+            at(node).left = leftRotate(own(at(node).left));
+        return rightRotate(node);
+    }
+    if (balance < -1) {
+        if (getBalance(at(node).right) > 0)
+            at(node).right = rightRotate(own(at(node).right));
+        return leftRotate(node);
+    }
+    return node;
+}
+
+// left is more than one level taller than right: walk down its right spine to a subtree
+// of right's height, hang the new node there and rebalance on the way back up
+AVL_CORE_TEMPLATE
+int AVL_CORE::joinRight(int left, const Key& key, int right) {
+    left = own(left);
+    int spine = at(left).right;
+    if (getHeight(spine) <= getHeight(right) + 1)
+        at(left).right = makeNode(spine, key, right);
+    else
+        at(left).right = joinRight(spine, key, right);
+    return rebalance(left);
+}
+
+AVL_CORE_TEMPLATE
+int AVL_CORE::joinLeft(int left, const Key& key, int right) {
+    right = own(right);
+    int spine = at(right).left;
+    if (getHeight(spine) <= getHeight(left) + 1)
+        at(right).left = makeNode(left, key, spine);
+    else
+        at(right).left = joinLeft(left, key, spine);
+    return rebalance(right);
+}
+
+// Every key in left must be below key and every key in right above it. O(|h(left) - h(right)|)
+AVL_CORE_TEMPLATE
+int AVL_CORE::join(int left, const Key& key, int right) {
+    if (getHeight(left) > getHeight(right) + 1) return joinRight(left, key, right);
+    if (getHeight(right) > getHeight(left) + 1) return joinLeft(left, key, right);
+    return makeNode(left, key, right);
+}
+
+// Like join, without a middle key
+AVL_CORE_TEMPLATE
+int AVL_CORE::join2(int left, int right) {
+    if (!left) return right;
+    Key key;
+    left = splitLast(left, key);
+    return join(left, key, right);
+}
+
+// Removes the largest key, returning the rest of the tree
+AVL_CORE_TEMPLATE
+int AVL_CORE::splitLast(int tree, Key& lastKey) {
+    int left, right;
+    Key key;
+    expose(tree, left, key, right);
+    if (!right) {
+        lastKey = key;
+        return left;
+    }
+    right = splitLast(right, lastKey);
+    return join(left, key, right);
+}
+
+// Keys below key go to left, keys above to right. O(log n)
+AVL_CORE_TEMPLATE
+void AVL_CORE::split(int tree, const Key& key, int& left, bool& found, int& right) {
+    if (!tree) {
+        left = 0;
+        right = 0;
+        found = false;
+        return;
+    }
+    int treeLeft, treeRight;
+    Key treeKey;
+    expose(tree, treeLeft, treeKey, treeRight);
+    if (less(key, treeKey)) {
+        int middle;
+        split(treeLeft, key, left, found, middle);
+        right = join(middle, treeKey, treeRight);
+    }
+    else if (less(treeKey, key)) {
+        int middle;
+        split(treeRight, key, middle, found, right);
+        left = join(treeLeft, treeKey, middle);
+    }
+    else {
+        left = treeLeft;
+        right = treeRight;
+        found = true;
+    }
+}
+
+// O(m log(n/m + 1)) for trees of sizes m <= n. The two recursive halves only ever see keys
+// on their own side of the split key, so they touch disjoint nodes and can run on separate
+// threads; forks says how many more levels may still spawn one.
+AVL_CORE_TEMPLATE
+int AVL_CORE::setOperation(SetOperation operation, int a, int b, int forks) {
+    if (operation == SetOperation::UNION) {
+        if (!a) return b;
+        if (!b) return a;
+    }
+    else if (operation == SetOperation::INTERSECTION) {
+        if (!a || !b) {
+            release(a);
+            release(b);
+            return 0;
+        }
+    }
+    else {
+        if (!a) {
+            release(b);
+            return 0;
+        }
+        if (!b) return a;
+    }
+
+    bool parallel = forks > 0 && at(a).size + at(b).size >= PARALLEL_GRAIN;
+    int aLeft, aRight, bLeft, bRight;
+    Key key;
+    bool found;
+    if (operation == SetOperation::DIFFERENCE) {
+        // Split a around b's root, which is dropped from the result
+        expose(b, bLeft, key, bRight);
+        split(a, key, aLeft, found, aRight);
+        found = false;
+    }
+    else {
+        expose(a, aLeft, key, aRight);
+        split(b, key, bLeft, found, bRight);
+        if (operation == SetOperation::UNION) found = true;
+    }
+
+    int left, right;
+    if (parallel) {
+        std::future<int> leftTask = std::async(std::launch::async, [this, operation, aLeft, bLeft, forks]() {
+            return setOperation(operation, aLeft, bLeft, forks - 1);
+        });
+        right = setOperation(operation, aRight, bRight, forks - 1);
+        left = leftTask.get();
+    }
+    else {
+        left = setOperation(operation, aLeft, bLeft, 0);
+        right = setOperation(operation, aRight, bRight, 0);
+    }
+    return found ? join(left, key, right) : join2(left, right);
+}
+
+// Applies the operation between the tree and the given keys (sorted in place)
+AVL_CORE_TEMPLATE
+void AVL_CORE::combine(SetOperation operation, std::vector<Key>& keys) {
+    settle(); // Joins need AVL inputs
+    sortUnique(keys);
+    int other = buildBalanced(keys, 0, static_cast<int>(keys.size()));
+
+    // Fork until there is roughly one task per hardware thread
+    int forks = 0;
+    while ((1u << forks) < std::thread::hardware_concurrency()) forks++;
+    if (getSize() + static_cast<int>(keys.size()) < PARALLEL_GRAIN) forks = 0;
+    // Tasks read nodes outside the lock while another task's allocation may add a slab
+    if (forks > 0) pool.pinTable();
+    concurrent = forks > 0;
+    changed();
+    root = setOperation(operation, root, other, forks);
+    concurrent = false;
+}
+
+AVL_CORE_TEMPLATE
+void AVL_CORE::combine(SetOperation operation, const AVLCore& other) {
+    // The other tree lives in its own pool, so its keys are rebuilt here in O(m) first
+    std::vector<Key> keys;
+    keys.reserve(other.getSize());
+    for (Iterator it = other.begin(); it.valid(); it.next())
+        keys.push_back(it.key());
+    combine(operation, keys);
+}
+
+// Writes nodes in preorder, so a node numbered k has its left child at k + 1 and its right
+// child just past the left subtree, at k + 1 + size(left)
+AVL_CORE_TEMPLATE
+bool AVL_CORE::writeBinary(FILE* file) {
+    static_assert(std::is_trivially_copyable<Key>::value, "binary snapshots copy keys byte for byte");
+    static_assert(alignof(Node) <= AVLSnapshotHeader::HEADER_BYTES, "nodes must stay aligned after the header");
+    refresh(); // Loading checks every height
+
+    char start[AVLSnapshotHeader::HEADER_BYTES] = {};
+    AVLSnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "AVLSNAP", 8);
+    header.version = AVLSnapshotHeader::VERSION;
+    header.orderMark = AVLSnapshotHeader::ORDER_MARK;
+    header.keyBytes = sizeof(Key);
+    header.nodeBytes = sizeof(Node);
+    header.nodes = getSize() + 1;
+    header.root = root ? 1 : 0;
+    std::memcpy(start, &header, sizeof(header));
+    fwrite(start, 1, sizeof(start), file);
+
+    // Zeroed first so padding bytes are written the same every time
+    std::vector<Node> buffer(1);
+    std::memset(static_cast<void*>(buffer.data()), 0, sizeof(Node));
+    buffer[0].refs = 1;
+    std::vector<std::pair<int, int> > stack; // Node and the number it gets
+    if (root) stack.push_back(std::make_pair(root, 1));
+    while (!stack.empty()) {
+        int node = stack.back().first;
+        int number = stack.back().second;
+        stack.pop_back();
+        const Node& n = at(node);
+        Node out;
+        std::memset(static_cast<void*>(&out), 0, sizeof(out));
+        out.key = n.key;
+        out.height = n.height;
+        // New to whoever tracks changes, like a freshly allocated node; a relaxed tree keeps
+        // its pending marks so settle() still finds the nodes out of balance
+        out.flags = Node::DIRTY | (n.flags & Node::PENDING);
+        out.size = n.size;
+        out.left = n.left ? number + 1 : 0;
+        out.right = n.right ? number + 1 + at(n.left).size : 0;
+        out.refs = 1;
+        buffer.push_back(out);
+        if (n.right) stack.push_back(std::make_pair(n.right, out.right));
+        if (n.left) stack.push_back(std::make_pair(n.left, out.left));
+        if (buffer.size() == 4096) {
+            fwrite(buffer.data(), sizeof(Node), buffer.size(), file);
+            buffer.clear();
+        }
+    }
+    fwrite(buffer.data(), sizeof(Node), buffer.size(), file);
+    return !ferror(file);
+}
+
+AVL_CORE_TEMPLATE
+bool AVL_CORE::adoptBinary(void* data, size_t bytes) {
+    static_assert(std::is_trivially_copyable<Key>::value, "binary snapshots copy keys byte for byte");
+
+    if (bytes < AVLSnapshotHeader::HEADER_BYTES) return false;
+    AVLSnapshotHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, "AVLSNAP", 8) != 0 || header.version != AVLSnapshotHeader::VERSION
+        || header.orderMark != AVLSnapshotHeader::ORDER_MARK || header.keyBytes != sizeof(Key) || header.nodeBytes != sizeof(Node))
+        return false;
+    if (header.nodes < 1 || static_cast<size_t>(header.nodes) > pool.maxNodes() || header.root != (header.nodes > 1 ? 1 : 0)
+        || (bytes - AVLSnapshotHeader::HEADER_BYTES) / sizeof(Node) < static_cast<size_t>(header.nodes))
+        return false;
+    Node* nodes = reinterpret_cast<Node*>(static_cast<char*>(data) + AVLSnapshotHeader::HEADER_BYTES);
+    if (!validBinary(nodes, header.nodes)) return false;
+
+    clear();
+    pool.adopt(nodes, header.nodes);
+    root = header.root;
+    return true;
+}
+
+// The file's links are followed without bounds checks once adopted, so a corrupt one must
+// not get that far. Preorder numbering fixes where every child has to be: node k's left
+// child at k + 1 and its right child at k + 1 + size(left). One pass from the last node
+// back sees children before their parents, so each node is checked against children
+// already known to be sound: links, height (below MAX_HEIGHT, so the fixed paths fit),
+// size, pending mark and key order. Nothing is allocated.
+AVL_CORE_TEMPLATE
+bool AVL_CORE::validBinary(const Node* nodes, int count) const {
+    const Node& sentinel = nodes[0];
+    if (sentinel.height != 0 || sentinel.size != 0 || sentinel.left != 0 || sentinel.right != 0) return false;
+    for (int k = count - 1; k >= 1; --k) {
+        const Node& n = nodes[k];
+        if (n.refs != 1 || (n.flags & ~(Node::DIRTY | Node::PENDING))) return false;
+        if (n.left != 0 && (n.left != k + 1 || n.left >= count)) return false;
+        const Node& left = nodes[n.left];
+        if (n.right != 0 && (n.right != k + 1 + left.size || n.right >= count)) return false;
+        const Node& right = nodes[n.right];
+        if (n.size != 1 + left.size + right.size || n.size > count - k) return false;
+        if (n.height != 1 + std::max(left.height, right.height) || n.height >= MAX_HEIGHT) return false;
+        int balance = left.height - right.height;
+        bool unsettled = balance > 1 || balance < -1 || ((left.flags | right.flags) & Node::PENDING);
+        if (unsettled && !(n.flags & Node::PENDING)) return false;
+
+        // Neighbours in key order: the largest key on the left, the smallest on the right
+        if (n.left) {
+            int previous = n.left;
+            while (nodes[previous].right) previous = nodes[previous].right;
+            if (!less(nodes[previous].key, n.key)) return false;
+        }
+        if (n.right) {
+            int next = n.right;
+            while (nodes[next].left) next = nodes[next].left;
+            if (!less(n.key, nodes[next].key)) return false;
+        }
+    }
+    // The root's subtree must take up every node, so none is left unreachable
+    return count == 1 || nodes[1].size == count - 1;
+}
+
+// No version survives a clear, so the pool is reset in one go instead of walking the nodes
+AVL_CORE_TEMPLATE
+void AVL_CORE::clear() {
+    changed();
+    root = 0;
+    // Resetting the pool frees every version at once, so first wait out the guards that
+    // may still be reading the published one. Guards starting after the epoch moves on
+    // see version 0, which never touches the pool.
+    published.store(0);
+    unsigned current = ++epoch;
+    while (oldestReader() < current)
+        std::this_thread::yield();
+    retired.clear();
+    pool.reset();
+}
+
+// Lays the keys out in one array so a search touches about log2(n) / log2(FROZEN_LINE + 1)
+// cache lines once prefetching is taken into account, instead of one scattered node per level
+AVL_CORE_TEMPLATE
+void AVL_CORE::freeze() {
+    frozen.clear();
+    if (!root) return;
+    frozen.resize(static_cast<size_t>(at(root).size) + 1);
+    Iterator it = begin();
+    fillFrozen(1, it);
+}
+
+// In-order walk over the implicit tree of positions, handing each the next key in order
+AVL_CORE_TEMPLATE
+void AVL_CORE::fillFrozen(size_t index, Iterator& it) {
+    if (index >= frozen.size()) return;
+    fillFrozen(2 * index, it);
+    frozen[index] = it.key();
+    it.next();
+    fillFrozen(2 * index + 1, it);
+}
+
+// Branch-free descent: the only data-dependent choice is the index arithmetic, and the
+// lines four levels down are already on their way while this level is compared
+AVL_CORE_TEMPLATE
+bool AVL_CORE::frozenContains(const Key& key) const {
+    const Key* keys = frozen.data();
+    size_t count = frozen.size();
+    size_t index = 1;
+    size_t candidate = 0; // Last position whose key was not below key
+    while (index < count) {
+        if (index * FROZEN_LINE < count) AVL_PREFETCH(keys + index * FROZEN_LINE);
+        bool right = less(keys[index], key);
+        candidate = right ? candidate : index;
+        index = 2 * index + right;
+    }
+    return candidate && !less(key, keys[candidate]);
+}
+
+// frozenContains for up to BATCH_LANES keys at once, one level of every search per round
+AVL_CORE_TEMPLATE
+void AVL_CORE::frozenBatch(const Key* keys, int count, bool* found) const {
+    const Key* frozenKeys = frozen.data();
+    size_t size = frozen.size();
+    size_t index[BATCH_LANES];
+    size_t candidate[BATCH_LANES];
+    for (int i = 0; i < count; ++i) {
+        index[i] = 1;
+        candidate[i] = 0;
+    }
+    bool active = true;
+    while (active) {
+        active = false;
+        for (int i = 0; i < count; ++i) {
+            if (index[i] >= size) continue;
+            if (index[i] * FROZEN_LINE < size) AVL_PREFETCH(frozenKeys + index[i] * FROZEN_LINE);
+            bool right = less(frozenKeys[index[i]], keys[i]);
+            candidate[i] = right ? candidate[i] : index[i];
+            index[i] = 2 * index[i] + right;
+            active = true;
+        }
+    }
+    for (int i = 0; i < count; ++i)
+        found[i] = candidate[i] && !less(keys[i], frozenKeys[candidate[i]]);
+}
+
+#undef AVL_CORE
+#undef AVL_CORE_TEMPLATE
+
+#endif
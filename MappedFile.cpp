@@ -0,0 +1,96 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#endif
+
+#ifdef _WIN32
+static std::wstring widen(const std::string& path) {
+    int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+    if (length <= 0) return std::wstring();
+    std::wstring widePath(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &widePath[0], length);
+    return widePath;
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+    std::wstring widePath = widen(path);
+    if (widePath.empty()) return false;
+
+    HANDLE file = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    // The view keeps the mapping and the file open, so both handles can go now
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) return false;
+    view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) return false;
+    bytes = static_cast<size_t>(fileSize.QuadPart);
+    mappedPath = path;
+    return true;
+}
+
+void MappedFile::close() {
+    if (view) UnmapViewOfFile(view);
+    view = nullptr;
+    bytes = 0;
+    mappedPath.clear();
+}
+
+bool replaceFile(const std::string& source, const std::string& target) {
+    return MoveFileExW(widen(source).c_str(), widen(target).c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+bool removeFile(const std::string& path) {
+    return DeleteFileW(widen(path).c_str()) != 0;
+}
+#else
+bool MappedFile::open(const std::string& path) {
+    close();
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) return false;
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size == 0) {
+        ::close(file);
+        return false;
+    }
+    // The mapping keeps the file open, so the descriptor can go now
+    void* address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    ::close(file);
+    if (address == MAP_FAILED) return false;
+    view = address;
+    bytes = static_cast<size_t>(status.st_size);
+    mappedPath = path;
+    return true;
+}
+
+void MappedFile::close() {
+    if (view) munmap(view, bytes);
+    view = nullptr;
+    bytes = 0;
+    mappedPath.clear();
+}
+
+bool replaceFile(const std::string& source, const std::string& target) {
+    return rename(source.c_str(), target.c_str()) == 0;
+}
+
+bool removeFile(const std::string& path) {
+    return unlink(path.c_str()) == 0;
+}
+#endif
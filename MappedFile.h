@@ -0,0 +1,43 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+#include <utility>
+
+// A whole file mapped copy-on-write: the pages are read from the file on first touch, and
+// writes stay private to this process (the file never changes). Kept in its own translation
+// unit so the platform headers stay away from raylib's.
+class MappedFile {
+public:
+    MappedFile() : view(nullptr), bytes(0) {}
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path); // UTF-8 path; false if it cannot be mapped (or is empty)
+    void close();
+    void* data() const { return view; }
+    size_t size() const { return bytes; }
+    const std::string& getPath() const { return mappedPath; } // Empty while nothing is mapped
+    void swap(MappedFile& other) {
+        std::swap(view, other.view);
+        std::swap(bytes, other.bytes);
+        mappedPath.swap(other.mappedPath);
+    }
+
+private:
+    void* view;
+    size_t bytes;
+    std::string mappedPath;
+};
+
+// Renames source over target in one step (UTF-8 paths). A snapshot is written beside its
+// target and moved into place this way, so a file some mapping still reads is never
+// truncated under it: POSIX keeps the old file alive for the mapping, and Windows refuses
+// to replace a mapped file.
+bool replaceFile(const std::string& source, const std::string& target);
+bool removeFile(const std::string& path);
+
+#endif
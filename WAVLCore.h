@@ -0,0 +1,431 @@
+#ifndef WAVL_CORE_H
+#define WAVL_CORE_H
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+// Weak AVL tree (rank-balanced tree of Haeupler, Sen and Tarjan), an alternative engine to
+// AVLCore for comparing update costs. Every node has a rank; a child's rank difference
+// (parent rank minus child rank, with a missing child at rank -1) is 1 or 2, and a leaf's
+// are both 1. No rank is stored: the two differences are one bit each, kept in the low bit
+// of the child links the way a pointer-based tree keeps them in pointer tag bits. Rebalancing
+// does at most two rotations per insert or erase (O(1) amortized work besides rank changes).
+// Unlike AVLCore it is a plain single-version tree: no snapshots, sizes or node hooks.
+
+// Children are (index << 1) | (rank difference - 1); index 0 is the empty child
+template <typename Key>
+struct WAVLNode {
+    Key key;
+    int left;
+    int right;
+};
+
+template <typename Key, typename Compare = std::less<Key>>
+class WAVLCore {
+public:
+    typedef WAVLNode<Key> Node;
+    // Rank is at most 2 log2(n + 1), so 64 levels outlast any pool an int can index
+    static const int MAX_HEIGHT = 64;
+
+    // In-order cursor with the root-to-node path in a fixed stack, as AVLCore::Iterator
+    class Iterator {
+    public:
+        bool valid() const { return depth > 0; }
+        const Key& key() const { return tree->nodes[stack[depth - 1]].key; }
+
+        void next() {
+            int child = tree->child(stack[depth - 1], false);
+            if (child) {
+                while (child) {
+                    stack[depth++] = child;
+                    child = tree->child(child, true);
+                }
+                return;
+            }
+            child = stack[--depth];
+            while (depth && tree->child(stack[depth - 1], false) == child)
+                child = stack[--depth];
+        }
+
+    private:
+        friend class WAVLCore;
+        explicit Iterator(const WAVLCore* owner) : tree(owner), depth(0) {}
+        const WAVLCore* tree;
+        int stack[MAX_HEIGHT];
+        int depth;
+    };
+
+    explicit WAVLCore(const Compare& compare = Compare()) : less(compare), root(0), count(0), freeList(0), rotations(0) {
+        nodes.push_back(Node()); // Index 0: the empty child
+    }
+
+    WAVLCore(const WAVLCore&) = delete;
+    WAVLCore& operator=(const WAVLCore&) = delete;
+
+    bool insert(const Key& key);
+    bool erase(const Key& key);
+    bool contains(const Key& key) const;
+    int getSize() const { return count; }
+    Iterator lowerBound(const Key& key) const;
+    void assign(std::vector<Key>& keys);
+    void clear();
+
+    long long getRotations() const { return rotations; } // Single rotations so far (a double counts two)
+    bool isBalanced() const { return checkedRank(root) >= -1; } // Full O(n) check of the rank rule
+
+private:
+    std::vector<Node> nodes; // Indices stay valid as it grows; nothing holds a Node*
+    Compare less;
+    int root;
+    int count;
+    int freeList; // Freed nodes, chained through their left link
+    long long rotations;
+
+    int child(int node, bool left) const { return (left ? nodes[node].left : nodes[node].right) >> 1; }
+    int difference(int node, bool left) const { return ((left ? nodes[node].left : nodes[node].right) & 1) + 1; }
+    void setChild(int node, bool left, int child, int difference) {
+        (left ? nodes[node].left : nodes[node].right) = (child << 1) | (difference - 1);
+    }
+    void setDifference(int node, bool left, int difference) { setChild(node, left, child(node, left), difference); }
+    int newNode(const Key& key);
+    void freeNode(int node);
+    void relink(const int* path, const bool* wentLeft, int level, int top);
+    void demoted(const int* path, const bool* wentLeft, int level);
+    void fixThreeChild(const int* path, const bool* wentLeft, int level);
+    int build(const std::vector<Key>& keys, int lo, int hi, int& rank);
+    int checkedRank(int node) const;
+};
+
+// Shorthand for the out-of-class definitions below
+#define WAVL_CORE_TEMPLATE template <typename Key, typename Compare>
+#define WAVL_CORE WAVLCore<Key, Compare>
+
+// A new node is a leaf: rank 0, both differences 1
+WAVL_CORE_TEMPLATE
+int WAVL_CORE::newNode(const Key& key) {
+    int node;
+    if (freeList) {
+        node = freeList;
+        freeList = nodes[node].left;
+    }
+    else {
+        node = static_cast<int>(nodes.size());
+        nodes.push_back(Node());
+    }
+    nodes[node].key = key;
+    nodes[node].left = 0;
+    nodes[node].right = 0;
+    return node;
+}
+
+WAVL_CORE_TEMPLATE
+void WAVL_CORE::freeNode(int node) {
+    nodes[node].key = Key();
+    nodes[node].left = freeList;
+    freeList = node;
+}
+
+// Hangs top where path[level] was; its rank is that node's rank, so the difference stays
+WAVL_CORE_TEMPLATE
+void WAVL_CORE::relink(const int* path, const bool* wentLeft, int level, int top) {
+    if (level == 0) root = top;
+    else setChild(path[level - 1], wentLeft[level - 1], top, difference(path[level - 1], wentLeft[level - 1]));
+}
+
+WAVL_CORE_TEMPLATE
+bool WAVL_CORE::contains(const Key& key) const {
+    int node = root;
+    while (node) {
+        const Node& n = nodes[node];
+        if (less(key, n.key)) node = n.left >> 1;
+        else if (less(n.key, key)) node = n.right >> 1;
+        else return true;
+    }
+    return false;
+}
+
+WAVL_CORE_TEMPLATE
+typename WAVL_CORE::Iterator WAVL_CORE::lowerBound(const Key& key) const {
+    Iterator it(this);
+    int answerDepth = 0;
+    int node = root;
+    while (node) {
+        it.stack[it.depth++] = node;
+        if (less(nodes[node].key, key)) {
+            node = child(node, false);
+            continue;
+        }
+        answerDepth = it.depth;
+        if (!less(key, nodes[node].key)) break;
+        node = child(node, true);
+    }
+    it.depth = answerDepth;
+    return it;
+}
+
+// Bottom-up: a new leaf (rank 0) under a leaf parent is a 0-child. Promote while its
+// sibling is a 1-child, which moves the 0-child up a level; otherwise one single or double
+// rotation ends it.
+WAVL_CORE_TEMPLATE
+bool WAVL_CORE::insert(const Key& key) {
+    int path[MAX_HEIGHT];
+    bool wentLeft[MAX_HEIGHT];
+    int depth = 0;
+    int node = root;
+    while (node) {
+        bool goLeft = less(key, nodes[node].key);
+        if (!goLeft && !less(nodes[node].key, key)) return false;
+        path[depth] = node;
+        wentLeft[depth++] = goLeft;
+        node = child(node, goLeft);
+    }
+    int created = newNode(key);
+    count++;
+    if (depth == 0) {
+        root = created;
+        return true;
+    }
+    int level = depth - 1;
+    bool wasTwo = difference(path[level], wentLeft[level]) == 2;
+    setChild(path[level], wentLeft[level], created, 1);
+    if (wasTwo) return true; // Parent was unary (rank 1); the leaf fits as a 1-child
+
+    // The child below path[level] on the wentLeft[level] side is a 0-child (its stored bit is stale)
+    for (;;) {
+        int parent = path[level];
+        bool left = wentLeft[level];
+        if (difference(parent, !left) == 1) {
+            // Promote parent: the 0-child becomes a 1-child, the sibling a 2-child
+            setDifference(parent, left, 1);
+            setDifference(parent, !left, 2);
+            if (level == 0) return true;
+            if (difference(path[level - 1], wentLeft[level - 1]) == 2) {
+                setDifference(path[level - 1], wentLeft[level - 1], 1);
+                return true;
+            }
+            level--;
+            continue;
+        }
+
+        // Sibling is a 2-child: rotate x (the 0-child, promoted before so its differences
+        // are 1 and 2) into parent's place
+        int x = child(parent, left);
+        int inner = child(x, !left);
+        int top;
+        if (difference(x, !left) == 2) {
+            // Single rotation; parent is demoted under x
+            setChild(parent, left, inner, 1);
+            setDifference(parent, !left, 1);
+            setChild(x, !left, parent, 1);
+            top = x;
+            rotations++;
+        }
+        else {
+            // Double rotation; inner rises two ranks, x and parent are demoted under it
+            int a = child(inner, left);
+            int b = child(inner, !left);
+            setChild(x, !left, a, difference(inner, left));
+            setDifference(x, left, 1);
+            setChild(parent, left, b, difference(inner, !left));
+            setDifference(parent, !left, 1);
+            setChild(inner, left, x, 1);
+            setChild(inner, !left, parent, 1);
+            top = inner;
+            rotations += 2;
+        }
+        relink(path, wentLeft, level, top);
+        return true;
+    }
+}
+
+// path[level] lost a rank; its own difference grows by one, which may make it a 3-child
+WAVL_CORE_TEMPLATE
+void WAVL_CORE::demoted(const int* path, const bool* wentLeft, int level) {
+    if (level == 0) return;
+    if (difference(path[level - 1], wentLeft[level - 1]) == 1)
+        setDifference(path[level - 1], wentLeft[level - 1], 2);
+    else
+        fixThreeChild(path, wentLeft, level - 1);
+}
+
+// The child of path[level] on the wentLeft[level] side is a 3-child (its stored bit is
+// stale). Demote while that fixes this level and moves the problem up; otherwise one
+// single or double rotation ends it.
+WAVL_CORE_TEMPLATE
+void WAVL_CORE::fixThreeChild(const int* path, const bool* wentLeft, int level) {
+    for (;;) {
+        int parent = path[level];
+        bool left = wentLeft[level];
+        int sibling = child(parent, !left);
+        if (difference(parent, !left) == 2) {
+            // Demote parent
+            setDifference(parent, left, 2);
+            setDifference(parent, !left, 1);
+        }
+        else if (difference(sibling, true) == 2 && difference(sibling, false) == 2) {
+            // Demote parent and sibling together
+            setDifference(parent, left, 2);
+            setDifference(sibling, true, 1);
+            setDifference(sibling, false, 1);
+        }
+        else {
+            int inner = child(sibling, left);
+            int innerDifference = difference(sibling, left);
+            int top;
+            if (difference(sibling, !left) == 1) {
+                // Single rotation: sibling is promoted over parent, which is demoted (twice
+                // if that leaves it a leaf)
+                int x = child(parent, left);
+                setChild(parent, !left, inner, innerDifference);
+                setDifference(parent, left, 2);
+                int parentDifference = 1;
+                if (!x && !inner) {
+                    setDifference(parent, left, 1);
+                    setDifference(parent, !left, 1);
+                    parentDifference = 2;
+                }
+                setChild(sibling, left, parent, parentDifference);
+                setDifference(sibling, !left, 2);
+                top = sibling;
+                rotations++;
+            }
+            else {
+                // Double rotation: inner rises over both, parent is demoted twice and sibling once
+                int a = child(inner, left);
+                int b = child(inner, !left);
+                setChild(parent, !left, a, difference(inner, left));
+                setDifference(parent, left, 1);
+                setChild(sibling, left, b, difference(inner, !left));
+                setDifference(sibling, !left, 1);
+                setChild(inner, left, parent, 2);
+                setChild(inner, !left, sibling, 2);
+                top = inner;
+                rotations += 2;
+            }
+            relink(path, wentLeft, level, top);
+            return;
+        }
+        // parent lost a rank
+        if (level == 0) return;
+        if (difference(path[level - 1], wentLeft[level - 1]) == 1) {
+            setDifference(path[level - 1], wentLeft[level - 1], 2);
+            return;
+        }
+        level--;
+    }
+}
+
+// A node with two children swaps keys with its successor, as in AVLCore::erase, so the node
+// unlinked has at most one child. That child (or the empty child) takes its place one rank
+// further down, making a 2- or 3-child, or a parent that is a leaf with differences 2, 2.
+WAVL_CORE_TEMPLATE
+bool WAVL_CORE::erase(const Key& key) {
+    int path[MAX_HEIGHT];
+    bool wentLeft[MAX_HEIGHT];
+    int depth = 0;
+    int node = root;
+    while (node) {
+        bool goLeft = less(key, nodes[node].key);
+        if (!goLeft && !less(nodes[node].key, key)) break;
+        path[depth] = node;
+        wentLeft[depth++] = goLeft;
+        node = child(node, goLeft);
+    }
+    if (!node) return false;
+
+    int target = node;
+    if (child(node, true) && child(node, false)) {
+        path[depth] = node;
+        wentLeft[depth++] = false;
+        node = child(node, false);
+        while (child(node, true)) {
+            path[depth] = node;
+            wentLeft[depth++] = true;
+            node = child(node, true);
+        }
+        nodes[target].key = nodes[node].key;
+    }
+
+    // A leaf or unary node's remaining child is a leaf (or empty) one rank below it
+    int replacement = child(node, true) ? child(node, true) : child(node, false);
+    freeNode(node);
+    count--;
+    if (depth == 0) {
+        root = replacement;
+        return true;
+    }
+    int level = depth - 1;
+    int parent = path[level];
+    bool left = wentLeft[level];
+    if (difference(parent, left) == 2) {
+        setChild(parent, left, replacement, 2);
+        fixThreeChild(path, wentLeft, level);
+        return true;
+    }
+    setChild(parent, left, replacement, 2);
+    if (!child(parent, true) && !child(parent, false)) {
+        // A leaf with differences 2, 2: demote it
+        setDifference(parent, true, 1);
+        setDifference(parent, false, 1);
+        demoted(path, wentLeft, level);
+    }
+    return true;
+}
+
+// Sorted, duplicate-free keys into a tree of minimum height; rank is height - 1
+WAVL_CORE_TEMPLATE
+int WAVL_CORE::build(const std::vector<Key>& keys, int lo, int hi, int& rank) {
+    if (lo >= hi) {
+        rank = -1;
+        return 0;
+    }
+    int mid = lo + (hi - lo) / 2;
+    int node = newNode(keys[mid]);
+    int leftRank, rightRank;
+    int left = build(keys, lo, mid, leftRank);
+    int right = build(keys, mid + 1, hi, rightRank);
+    rank = 1 + std::max(leftRank, rightRank);
+    setChild(node, true, left, rank - leftRank);
+    setChild(node, false, right, rank - rightRank);
+    return node;
+}
+
+WAVL_CORE_TEMPLATE
+void WAVL_CORE::assign(std::vector<Key>& keys) {
+    std::sort(keys.begin(), keys.end(), less);
+    keys.erase(std::unique(keys.begin(), keys.end(), [this](const Key& a, const Key& b) { return !less(a, b) && !less(b, a); }), keys.end());
+    clear();
+    int rank;
+    root = build(keys, 0, static_cast<int>(keys.size()), rank);
+    count = static_cast<int>(keys.size());
+}
+
+WAVL_CORE_TEMPLATE
+void WAVL_CORE::clear() {
+    nodes.resize(1);
+    root = 0;
+    count = 0;
+    freeList = 0;
+}
+
+// Rank of the subtree (-1 when empty), or -2 if a difference, a leaf or the key order is wrong
+WAVL_CORE_TEMPLATE
+int WAVL_CORE::checkedRank(int node) const {
+    if (!node) return -1;
+    int left = child(node, true);
+    int right = child(node, false);
+    if ((left && !less(nodes[left].key, nodes[node].key)) || (right && !less(nodes[node].key, nodes[right].key))) return -2;
+    int leftRank = checkedRank(left);
+    int rightRank = checkedRank(right);
+    if (leftRank < -1 || rightRank < -1) return -2;
+    int rank = leftRank + difference(node, true);
+    if (rank != rightRank + difference(node, false)) return -2;
+    if (!left && !right && rank != 0) return -2;
+    return rank;
+}
+
+#undef WAVL_CORE
+#undef WAVL_CORE_TEMPLATE
+
+#endif
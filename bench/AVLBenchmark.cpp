@@ -0,0 +1,877 @@
+// Throughput benchmark for the AVL engine (AVLCore, the tree behind the visualizer)
+// against the weak AVL engine (WAVLCore), std::set and a simple in-memory B-tree. Runs
+// without a window:
+//
+//     g++ -std=c++17 -O2 -I.. AVLBenchmark.cpp ../MappedFile.cpp -o AVLBenchmark -pthread
+//     AVLBenchmark [maxKeys]          (default 1000000; sizes go 10^3, 10^4, ... up to maxKeys)
+//
+// On Windows link psapi.lib for the peak RSS column.
+//
+// Every structure gets the same key streams: uniform, sorted, reverse-sorted and Zipfian.
+// Per run it measures insert, prepare (one call doing any work a structure defers until
+// searching, counted in keys per second; "-" where there is none), search, batch
+// (searchBatch over BATCH_SIZE keys; a loop of lookups for the other structures), range
+// (up to RANGE_LENGTH keys from a lower bound), erase and bulk load. The AVLfrozen rows
+// repeat AVLCore with searches served by freeze(), the AVLfinger rows with inserts and
+// searches starting from a Finger, and the AVLrelaxed rows with relaxed-balance inserts
+// settled in the prepare phase (their sorted and reverse inserts are the bursts the mode
+// is for; set them against AVLCore's). The AVLshared rows insert with a publish() after every
+// key while READER_THREADS threads look keys up through ReadGuards: "insert" is the
+// writer's rate, "readers" all lookups per second.
+// The AVLbinary rows save the loaded tree as a binary snapshot ("save"), map it back
+// ("map", both in keys per second) and search the mapped tree while its pages fault in.
+// The AVLunion rows merge every key into a tree loaded with the first half, using
+// insertBatch() while a snapshot() of the tree is held, so the set operation's parallel
+// tasks copy nodes and grow the pool together (in keys per second).
+// Single operations are timed one by one, so the ns/op percentiles include the cost of
+// reading the clock (some tens of ns). Allocation counts and heap bytes come from the
+// replaced global operator new below.
+
+#include "AVLCore.h"
+#include "WAVLCore.h"
+#include "MappedFile.h"
+#include <set>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+#include <utility>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static int __builtin_clzll(unsigned long long value) {
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return 63 - static_cast<int>(index);
+}
+#endif
+
+// Allocation counting
+
+static std::atomic<size_t> allocationCount(0);
+static std::atomic<size_t> heapBytes(0);
+static std::atomic<size_t> peakHeapBytes(0);
+
+// Each block carries its size in a header so delete can subtract it again
+static const size_t HEADER = 16;
+
+#ifdef __GNUC__
+// GCC sees malloc/free inside replaced new/delete as a mismatch once they are inlined
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+    char* block = static_cast<char*>(std::malloc(size + HEADER));
+    if (!block) throw std::bad_alloc();
+    *reinterpret_cast<size_t*>(block) = size;
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    size_t now = heapBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = peakHeapBytes.load(std::memory_order_relaxed);
+    while (now > peak && !peakHeapBytes.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+    return block + HEADER;
+}
+
+void operator delete(void* pointer) noexcept {
+    if (!pointer) return;
+    char* block = static_cast<char*>(pointer) - HEADER;
+    heapBytes.fetch_sub(*reinterpret_cast<size_t*>(block), std::memory_order_relaxed);
+    std::free(block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* pointer) noexcept { operator delete(pointer); }
+void operator delete(void* pointer, size_t) noexcept { operator delete(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { operator delete(pointer); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return operator new(size);
+    }
+    catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { operator delete(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { operator delete(pointer); }
+
+// Process-wide high-water mark in MB
+static double peakRssMegabytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize / 1048576.0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // Reported in KB on Linux
+#endif
+}
+
+// Latencies
+
+// Log-linear histogram: 16 sub-buckets per power of two, so percentiles are within about
+// 6% and recording a sample never allocates
+class LatencyHistogram {
+private:
+    static const int SUB_BITS = 4;
+    static const int SUB = 1 << SUB_BITS;
+    static const int BUCKETS = SUB + 60 * SUB;
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+
+    static int bucketOf(uint64_t ns) {
+        if (ns < SUB) return static_cast<int>(ns);
+        int exponent = 63 - __builtin_clzll(ns);
+        int sub = static_cast<int>((ns >> (exponent - SUB_BITS)) & (SUB - 1));
+        return SUB + (exponent - SUB_BITS) * SUB + sub;
+    }
+
+    // Smallest value of a bucket
+    static uint64_t valueOf(int bucket) {
+        if (bucket < SUB) return bucket;
+        int exponent = (bucket - SUB) / SUB + SUB_BITS;
+        uint64_t sub = (bucket - SUB) % SUB;
+        return (static_cast<uint64_t>(SUB) + sub) << (exponent - SUB_BITS);
+    }
+
+public:
+    LatencyHistogram() { clear(); }
+    void clear() {
+        std::fill(counts, counts + BUCKETS, 0);
+        total = 0;
+    }
+    void add(uint64_t ns) {
+        counts[bucketOf(ns)]++;
+        total++;
+    }
+    uint64_t percentile(double p) const {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(p * total));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank && counts[i]) return valueOf(i);
+        }
+        return 0;
+    }
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t nanosecondsSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// B-tree
+
+// Textbook B-tree (Cormen et al., chapter 18) with minimum degree DEGREE: every node but the
+// root holds DEGREE - 1 to 2 * DEGREE - 1 sorted keys. Insert splits full nodes on the way
+// down and erase tops up minimal nodes on the way down, so both are one pass.
+class BTree {
+private:
+    static const int DEGREE = 16;
+    static const int MAX_KEYS = 2 * DEGREE - 1;
+
+    struct BNode {
+        int count;
+        bool leaf;
+        int keys[MAX_KEYS];
+        BNode* children[MAX_KEYS + 1];
+    };
+
+    BNode* root;
+    int size;
+
+    static BNode* newNode(bool leaf) {
+        BNode* node = new BNode;
+        node->count = 0;
+        node->leaf = leaf;
+        return node;
+    }
+
+    static void destroy(BNode* node) {
+        if (!node->leaf) {
+            for (int i = 0; i <= node->count; ++i)
+                destroy(node->children[i]);
+        }
+        delete node;
+    }
+
+    static int lowerIndex(const BNode* node, int key) {
+        return static_cast<int>(std::lower_bound(node->keys, node->keys + node->count, key) - node->keys);
+    }
+
+    // Moves the upper half of the full child i into a new sibling, lifting the median into parent
+    static void splitChild(BNode* parent, int i) {
+        BNode* full = parent->children[i];
+        BNode* sibling = newNode(full->leaf);
+        sibling->count = DEGREE - 1;
+        std::copy(full->keys + DEGREE, full->keys + MAX_KEYS, sibling->keys);
+        if (!full->leaf)
+            std::copy(full->children + DEGREE, full->children + MAX_KEYS + 1, sibling->children);
+        full->count = DEGREE - 1;
+
+        std::copy_backward(parent->children + i + 1, parent->children + parent->count + 1, parent->children + parent->count + 2);
+        parent->children[i + 1] = sibling;
+        std::copy_backward(parent->keys + i, parent->keys + parent->count, parent->keys + parent->count + 1);
+        parent->keys[i] = full->keys[DEGREE - 1];
+        parent->count++;
+    }
+
+    // Folds key i of parent and child i + 1 into child i (both children minimal)
+    static void merge(BNode* parent, int i) {
+        BNode* left = parent->children[i];
+        BNode* right = parent->children[i + 1];
+        left->keys[DEGREE - 1] = parent->keys[i];
+        std::copy(right->keys, right->keys + right->count, left->keys + DEGREE);
+        if (!left->leaf)
+            std::copy(right->children, right->children + right->count + 1, left->children + DEGREE);
+        left->count = MAX_KEYS;
+
+        std::copy(parent->keys + i + 1, parent->keys + parent->count, parent->keys + i);
+        std::copy(parent->children + i + 2, parent->children + parent->count + 1, parent->children + i + 1);
+        parent->count--;
+        delete right;
+    }
+
+    // Child i takes one key through the parent from its left sibling
+    static void borrowLeft(BNode* parent, int i) {
+        BNode* child = parent->children[i];
+        BNode* sibling = parent->children[i - 1];
+        std::copy_backward(child->keys, child->keys + child->count, child->keys + child->count + 1);
+        child->keys[0] = parent->keys[i - 1];
+        if (!child->leaf) {
+            std::copy_backward(child->children, child->children + child->count + 1, child->children + child->count + 2);
+            child->children[0] = sibling->children[sibling->count];
+        }
+        parent->keys[i - 1] = sibling->keys[sibling->count - 1];
+        sibling->count--;
+        child->count++;
+    }
+
+    static void borrowRight(BNode* parent, int i) {
+        BNode* child = parent->children[i];
+        BNode* sibling = parent->children[i + 1];
+        child->keys[child->count] = parent->keys[i];
+        if (!child->leaf) child->children[child->count + 1] = sibling->children[0];
+        parent->keys[i] = sibling->keys[0];
+        std::copy(sibling->keys + 1, sibling->keys + sibling->count, sibling->keys);
+        if (!sibling->leaf)
+            std::copy(sibling->children + 1, sibling->children + sibling->count + 1, sibling->children);
+        sibling->count--;
+        child->count++;
+    }
+
+    // node has at least DEGREE keys unless it is the root
+    static bool eraseFrom(BNode* node, int key) {
+        while (true) {
+            int i = lowerIndex(node, key);
+            bool here = i < node->count && node->keys[i] == key;
+            if (node->leaf) {
+                if (!here) return false;
+                std::copy(node->keys + i + 1, node->keys + node->count, node->keys + i);
+                node->count--;
+                return true;
+            }
+            if (here) {
+                BNode* left = node->children[i];
+                BNode* right = node->children[i + 1];
+                if (left->count >= DEGREE) {
+                    // Replace with the predecessor and erase that from the left subtree
+                    BNode* last = left;
+                    while (!last->leaf) last = last->children[last->count];
+                    key = last->keys[last->count - 1];
+                    node->keys[i] = key;
+                    node = left;
+                }
+                else if (right->count >= DEGREE) {
+                    BNode* first = right;
+                    while (!first->leaf) first = first->children[0];
+                    key = first->keys[0];
+                    node->keys[i] = key;
+                    node = right;
+                }
+                else {
+                    merge(node, i);
+                    node = left;
+                }
+                continue;
+            }
+            if (node->children[i]->count == DEGREE - 1) {
+                if (i > 0 && node->children[i - 1]->count >= DEGREE) {
+                    borrowLeft(node, i);
+                }
+                else if (i < node->count && node->children[i + 1]->count >= DEGREE) {
+                    borrowRight(node, i);
+                }
+                else {
+                    if (i == node->count) i--;
+                    merge(node, i);
+                }
+            }
+            node = node->children[i];
+        }
+    }
+
+    static void scan(const BNode* node, int lo, int limit, int& count, long long& sum) {
+        for (int i = lowerIndex(node, lo); i <= node->count && count < limit; ++i) {
+            if (!node->leaf) scan(node->children[i], lo, limit, count, sum);
+            if (i < node->count && count < limit) {
+                sum += node->keys[i];
+                count++;
+            }
+        }
+    }
+
+public:
+    BTree() : root(newNode(true)), size(0) {}
+    ~BTree() { destroy(root); }
+    BTree(const BTree&) = delete;
+    BTree& operator=(const BTree&) = delete;
+
+    int getSize() const { return size; }
+
+    bool contains(int key) const {
+        const BNode* node = root;
+        while (true) {
+            int i = lowerIndex(node, key);
+            if (i < node->count && node->keys[i] == key) return true;
+            if (node->leaf) return false;
+            node = node->children[i];
+        }
+    }
+
+    bool insert(int key) {
+        if (root->count == MAX_KEYS) {
+            BNode* top = newNode(false);
+            top->children[0] = root;
+            root = top;
+            splitChild(top, 0);
+        }
+        BNode* node = root;
+        while (true) {
+            int i = lowerIndex(node, key);
+            if (i < node->count && node->keys[i] == key) return false;
+            if (node->leaf) {
+                std::copy_backward(node->keys + i, node->keys + node->count, node->keys + node->count + 1);
+                node->keys[i] = key;
+                node->count++;
+                size++;
+                return true;
+            }
+            if (node->children[i]->count == MAX_KEYS) {
+                splitChild(node, i);
+                if (node->keys[i] == key) return false;
+                if (node->keys[i] < key) i++;
+            }
+            node = node->children[i];
+        }
+    }
+
+    bool erase(int key) {
+        bool erased = eraseFrom(root, key);
+        if (root->count == 0 && !root->leaf) {
+            BNode* old = root;
+            root = root->children[0];
+            delete old;
+        }
+        if (erased) size--;
+        return erased;
+    }
+
+    // Sums up to limit keys from the first key >= lo, returning how many there were
+    int rangeSum(int lo, int limit, long long& sum) const {
+        int count = 0;
+        scan(root, lo, limit, count, sum);
+        return count;
+    }
+};
+
+// Workloads
+
+enum class Distribution { UNIFORM, SORTED, REVERSE, ZIPFIAN };
+
+static const char* distributionName(Distribution distribution) {
+    switch (distribution) {
+    case Distribution::UNIFORM: return "uniform";
+    case Distribution::SORTED: return "sorted";
+    case Distribution::REVERSE: return "reverse";
+    default: return "zipfian";
+    }
+}
+
+// Spreads ranks over the int range so popular Zipfian keys do not sit next to each other
+static int scramble(uint32_t rank) {
+    return static_cast<int>((rank * 2654435761u) >> 1);
+}
+
+// Zipfian ranks over [0, n) with skew THETA, by the closed form of Gray et al.,
+// "Quickly Generating Billion-Record Synthetic Databases" (as used by YCSB)
+class ZipfianGenerator {
+private:
+    static constexpr double THETA = 0.99;
+    uint32_t n;
+    double alpha, zetan, eta;
+    std::uniform_real_distribution<double> uniform;
+
+    static double zeta(uint32_t n) {
+        double sum = 0;
+        for (uint32_t i = 1; i <= n; ++i)
+            sum += 1.0 / std::pow(static_cast<double>(i), THETA);
+        return sum;
+    }
+
+public:
+    explicit ZipfianGenerator(uint32_t count) : n(count), uniform(0.0, 1.0) {
+        alpha = 1.0 / (1.0 - THETA);
+        zetan = zeta(n);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - THETA)) / (1.0 - zeta(2) / zetan);
+    }
+
+    uint32_t next(std::mt19937& random) {
+        double u = uniform(random);
+        double uz = u * zetan;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, THETA)) return 1;
+        uint32_t rank = static_cast<uint32_t>(n * std::pow(eta * u - eta + 1.0, alpha));
+        return std::min(rank, n - 1);
+    }
+};
+
+// Keys inserted (and later erased, in the same order) by one run
+static std::vector<int> makeKeys(Distribution distribution, int count, std::mt19937& random) {
+    std::vector<int> keys(count);
+    if (distribution == Distribution::UNIFORM) {
+        std::uniform_int_distribution<int> any(0, INT32_MAX);
+        for (int& key : keys) key = any(random);
+    }
+    else if (distribution == Distribution::ZIPFIAN) {
+        ZipfianGenerator zipf(count);
+        for (int& key : keys) key = scramble(zipf.next(random));
+    }
+    else {
+        for (int i = 0; i < count; ++i)
+            keys[i] = 2 * (distribution == Distribution::SORTED ? i : count - 1 - i);
+    }
+    return keys;
+}
+
+// Keys searched for. Uniform and Zipfian streams draw fresh keys (mostly misses and hot
+// keys respectively); the sorted streams look their own keys up in random order.
+static std::vector<int> makeLookups(Distribution distribution, const std::vector<int>& keys, std::mt19937& random) {
+    if (distribution == Distribution::UNIFORM || distribution == Distribution::ZIPFIAN)
+        return makeKeys(distribution, static_cast<int>(keys.size()), random);
+    std::vector<int> lookups = keys;
+    std::shuffle(lookups.begin(), lookups.end(), random);
+    return lookups;
+}
+
+// Adapters giving the three structures one interface
+
+static const int RANGE_LENGTH = 100;
+static const int BATCH_SIZE = 1024; // Keys per searchBatch call in the batch phase
+
+struct AVLSubject {
+    static const char* name() { return "AVLCore"; }
+    static const bool PREPARES = false; // prepareSearch() does nothing
+    AVLCore<int> tree;
+    bool insert(int key) { return tree.insert(key); }
+    bool contains(int key) { return tree.contains(key); }
+    void searchBatch(const int* keys, int count, bool* found) { tree.searchBatch(keys, count, found); }
+    bool erase(int key) { return tree.erase(key); }
+    int size() { return tree.getSize(); }
+    int range(int lo, long long& sum) {
+        int count = 0;
+        for (AVLCore<int>::Iterator it = tree.lowerBound(lo); it.valid() && count < RANGE_LENGTH; it.next()) {
+            sum += it.key();
+            count++;
+        }
+        return count;
+    }
+    void load(std::vector<int>& keys) { tree.assign(keys); }
+    void prepareSearch() {}
+};
+
+// Same engine, searching the Eytzinger copy made by freeze()
+struct FrozenSubject : AVLSubject {
+    static const char* name() { return "AVLfrozen"; }
+    static const bool PREPARES = true;
+    void prepareSearch() { tree.freeze(); }
+};
+
+// Same engine, inserting and searching from a finger left by the previous key
+struct FingerSubject : AVLSubject {
+    static const char* name() { return "AVLfinger"; }
+    AVLCore<int>::Finger finger;
+    bool insert(int key) { return tree.insert(key, finger); }
+    bool contains(int key) { return tree.contains(key, finger); }
+};
+
+// Same engine, deferring rotations while inserting and settling before the searches
+struct RelaxedSubject : AVLSubject {
+    static const char* name() { return "AVLrelaxed"; }
+    static const bool PREPARES = true;
+    RelaxedSubject() { tree.setRelaxed(true); }
+    void prepareSearch() { tree.setRelaxed(false); }
+};
+
+struct WAVLSubject {
+    static const char* name() { return "WAVLCore"; }
+    static const bool PREPARES = false;
+    WAVLCore<int> tree;
+    bool insert(int key) { return tree.insert(key); }
+    bool contains(int key) { return tree.contains(key); }
+    void searchBatch(const int* keys, int count, bool* found) {
+        for (int i = 0; i < count; ++i) found[i] = contains(keys[i]);
+    }
+    bool erase(int key) { return tree.erase(key); }
+    int size() { return tree.getSize(); }
+    int range(int lo, long long& sum) {
+        int count = 0;
+        for (WAVLCore<int>::Iterator it = tree.lowerBound(lo); it.valid() && count < RANGE_LENGTH; it.next()) {
+            sum += it.key();
+            count++;
+        }
+        return count;
+    }
+    void load(std::vector<int>& keys) { tree.assign(keys); }
+    void prepareSearch() {}
+};
+
+struct SetSubject {
+    static const char* name() { return "std::set"; }
+    static const bool PREPARES = false;
+    std::set<int> tree;
+    bool insert(int key) { return tree.insert(key).second; }
+    bool contains(int key) { return tree.find(key) != tree.end(); }
+    void searchBatch(const int* keys, int count, bool* found) {
+        for (int i = 0; i < count; ++i) found[i] = contains(keys[i]);
+    }
+    bool erase(int key) { return tree.erase(key) == 1; }
+    int size() { return static_cast<int>(tree.size()); }
+    int range(int lo, long long& sum) {
+        int count = 0;
+        for (std::set<int>::iterator it = tree.lower_bound(lo); it != tree.end() && count < RANGE_LENGTH; ++it) {
+            sum += *it;
+            count++;
+        }
+        return count;
+    }
+    // Sorted input makes the range constructor linear, the fairest match for assign()
+    void load(std::vector<int>& keys) {
+        std::sort(keys.begin(), keys.end());
+        tree = std::set<int>(keys.begin(), keys.end());
+    }
+    void prepareSearch() {}
+};
+
+struct BTreeSubject {
+    static const char* name() { return "B-tree"; }
+    static const bool PREPARES = false;
+    BTree tree;
+    bool insert(int key) { return tree.insert(key); }
+    bool contains(int key) { return tree.contains(key); }
+    void searchBatch(const int* keys, int count, bool* found) {
+        for (int i = 0; i < count; ++i) found[i] = contains(keys[i]);
+    }
+    bool erase(int key) { return tree.erase(key); }
+    int size() { return tree.getSize(); }
+    int range(int lo, long long& sum) { return tree.rangeSum(lo, RANGE_LENGTH, sum); }
+    void load(std::vector<int>& keys) {
+        std::sort(keys.begin(), keys.end());
+        for (int key : keys) tree.insert(key);
+    }
+    void prepareSearch() {}
+};
+
+// Measuring
+
+struct Measurement {
+    LatencyHistogram latency;
+    long long operations;
+    uint64_t elapsed; // ns of wall time for the whole phase
+    size_t allocations;
+    size_t peakHeap;  // Highest heap use during the phase, in bytes
+
+    void start() {
+        latency.clear();
+        operations = 0;
+        allocations = allocationCount.load();
+        peakHeapBytes.store(heapBytes.load());
+    }
+    void finish(Clock::time_point began) {
+        elapsed = nanosecondsSince(began);
+        allocations = allocationCount.load() - allocations;
+        peakHeap = peakHeapBytes.load();
+    }
+};
+
+static void report(const char* structure, Distribution distribution, int count, const char* phase, const Measurement& m, bool percentiles) {
+    double seconds = m.elapsed / 1e9;
+    double opsPerSecond = seconds > 0 ? m.operations / seconds : 0;
+    std::printf("%-9s %-8s %9d %-7s", structure, distributionName(distribution), count, phase);
+    if (m.operations)
+        std::printf(" %12.0f", opsPerSecond);
+    else
+        std::printf(" %12s", "-");
+    if (percentiles)
+        std::printf(" %7llu %7llu %7llu", static_cast<unsigned long long>(m.latency.percentile(0.5)),
+            static_cast<unsigned long long>(m.latency.percentile(0.9)), static_cast<unsigned long long>(m.latency.percentile(0.99)));
+    else
+        std::printf(" %7s %7s %7s", "-", "-", "-");
+    std::printf(" %9.3f %10.1f %9.1f\n", m.operations ? static_cast<double>(m.allocations) / m.operations : 0.0,
+        m.peakHeap / 1048576.0, peakRssMegabytes());
+}
+
+// Times every call of operation(i) for i in [0, count)
+template <typename Operation>
+static void measure(Measurement& m, int count, Operation operation) {
+    m.start();
+    Clock::time_point began = Clock::now();
+    for (int i = 0; i < count; ++i) {
+        Clock::time_point start = Clock::now();
+        operation(i);
+        m.latency.add(nanosecondsSince(start));
+    }
+    m.operations = count;
+    m.finish(began);
+}
+
+// Returns the sizes seen after inserting and after bulk loading, so the structures can
+// be checked against each other
+template <typename Subject>
+static std::pair<int, int> run(Distribution distribution, const std::vector<int>& keys, const std::vector<int>& lookups, long long& checksum) {
+    int count = static_cast<int>(keys.size());
+    std::pair<int, int> sizes;
+    Measurement m;
+    {
+        Subject subject;
+        measure(m, count, [&](int i) { subject.insert(keys[i]); });
+        report(Subject::name(), distribution, count, "insert", m, true);
+        sizes.first = subject.size();
+
+        m.start();
+        Clock::time_point began = Clock::now();
+        subject.prepareSearch();
+        m.operations = Subject::PREPARES ? count : 0; // No rate for a no-op
+        m.finish(began);
+        report(Subject::name(), distribution, count, "prepare", m, false);
+
+        int found = 0;
+        measure(m, count, [&](int i) { found += subject.contains(lookups[i]); });
+        report(Subject::name(), distribution, count, "search", m, true);
+        checksum += found;
+
+        // Timed per call and divided by the keys in it, so the percentiles are per key like
+        // the search row's (averaged over each batch of up to BATCH_SIZE keys)
+        bool hits[BATCH_SIZE];
+        int batches = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+        found = 0;
+        m.start();
+        began = Clock::now();
+        for (int i = 0; i < batches; ++i) {
+            int first = i * BATCH_SIZE;
+            int keysInBatch = std::min(BATCH_SIZE, count - first);
+            Clock::time_point start = Clock::now();
+            subject.searchBatch(lookups.data() + first, keysInBatch, hits);
+            m.latency.add(nanosecondsSince(start) / keysInBatch);
+            for (int j = 0; j < keysInBatch; ++j) found += hits[j];
+        }
+        m.operations = count;
+        m.finish(began);
+        report(Subject::name(), distribution, count, "batch", m, true);
+        checksum += found;
+
+        int scans = std::max(count / 10, 100);
+        long long sum = 0;
+        measure(m, scans, [&](int i) { subject.range(lookups[i % count], sum); });
+        report(Subject::name(), distribution, count, "range", m, true);
+        checksum += sum;
+
+        measure(m, count, [&](int i) { subject.erase(keys[i]); });
+        report(Subject::name(), distribution, count, "erase", m, true);
+        if (subject.size() != 0) std::printf("!! %s kept %d keys after erasing all\n", Subject::name(), subject.size());
+    }
+    {
+        // One call over all keys; ops/sec counts keys, so it compares with insert
+        Subject subject;
+        std::vector<int> copy = keys;
+        m.start();
+        Clock::time_point began = Clock::now();
+        subject.load(copy);
+        m.operations = count;
+        m.finish(began);
+        report(Subject::name(), distribution, count, "load", m, false);
+        sizes.second = subject.size();
+    }
+    return sizes;
+}
+
+static const char* SNAPSHOT_PATH = "AVLBenchmark.avl";
+
+// Returns the size of the mapped tree, or -1 if the snapshot could not be written or mapped
+// or its searches disagree with the tree it was saved from
+static int runSnapshot(Distribution distribution, const std::vector<int>& keys, const std::vector<int>& lookups) {
+    int count = static_cast<int>(keys.size());
+    Measurement m;
+    AVLCore<int> source;
+    std::vector<int> copy = keys;
+    source.assign(copy);
+
+    m.start();
+    Clock::time_point began = Clock::now();
+    FILE* file = std::fopen(SNAPSHOT_PATH, "wb");
+    bool written = file && source.writeBinary(file);
+    if (file) written = std::fclose(file) == 0 && written;
+    m.operations = count;
+    m.finish(began);
+    if (!written) return -1;
+    report("AVLbinary", distribution, count, "save", m, false);
+
+    int size;
+    {
+        // Declared first so the tree lets go of the mapping before it is closed
+        MappedFile mapping;
+        AVLCore<int> tree;
+        m.start();
+        began = Clock::now();
+        bool adopted = mapping.open(SNAPSHOT_PATH) && tree.adoptBinary(mapping.data(), mapping.size());
+        m.operations = count;
+        m.finish(began);
+        if (!adopted) return -1;
+        report("AVLbinary", distribution, count, "map", m, false);
+
+        int found = 0;
+        measure(m, count, [&](int i) { found += tree.contains(lookups[i]); });
+        report("AVLbinary", distribution, count, "search", m, true);
+        for (int lookup : lookups)
+            found -= source.contains(lookup);
+        size = found == 0 ? tree.getSize() : -1;
+    }
+    std::remove(SNAPSHOT_PATH);
+    return size;
+}
+
+// Returns the size after the union, or -1 if the snapshot taken before it changed
+static int runUnion(Distribution distribution, const std::vector<int>& keys) {
+    int count = static_cast<int>(keys.size());
+    AVLCore<int> tree;
+    std::vector<int> half(keys.begin(), keys.begin() + count / 2);
+    tree.assign(half);
+    int before = tree.getSize();
+    int version = tree.snapshot();
+
+    Measurement m;
+    std::vector<int> copy = keys;
+    m.start();
+    Clock::time_point began = Clock::now();
+    tree.insertBatch(copy);
+    m.operations = count;
+    m.finish(began);
+    report("AVLunion", distribution, count, "union", m, false);
+
+    int size = tree.getSize();
+    int current = tree.exchange(version);
+    if (tree.getSize() != before || !tree.isBalanced()) size = -1;
+    tree.release(tree.exchange(current));
+    return tree.isBalanced() ? size : -1;
+}
+
+static const int READER_THREADS = 3;
+
+// One writer inserting and publishing while the readers search the published versions.
+// Returns the size the readers see once the writer is done.
+static int runShared(Distribution distribution, const std::vector<int>& keys, const std::vector<int>& lookups) {
+    int count = static_cast<int>(keys.size());
+    AVLCore<int> tree;
+    std::atomic<bool> writing(true);
+    std::atomic<long long> lookupsDone(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < READER_THREADS; ++t) {
+        readers.push_back(std::thread([&, t]() {
+            long long done = 0;
+            for (int i = t; writing.load(std::memory_order_relaxed); i = (i + 1) % count) {
+                AVLCore<int>::ReadGuard guard(tree);
+                guard.contains(lookups[i]);
+                done++;
+            }
+            lookupsDone += done;
+        }));
+    }
+
+    Measurement m;
+    measure(m, count, [&](int i) {
+        tree.insert(keys[i]);
+        tree.publish();
+    });
+    writing = false;
+    for (std::thread& reader : readers)
+        reader.join();
+    report("AVLshared", distribution, count, "insert", m, true);
+
+    Measurement read;
+    read.start();
+    read.operations = lookupsDone.load();
+    read.elapsed = m.elapsed;
+    read.peakHeap = m.peakHeap;
+    read.allocations = 0;
+    report("AVLshared", distribution, count, "readers", read, false);
+
+    AVLCore<int>::ReadGuard guard(tree);
+    return guard.getSize();
+}
+
+int main(int argc, char** argv) {
+    long long maxKeys = argc > 1 ? std::atoll(argv[1]) : 1000000;
+    if (maxKeys < 1000 || maxKeys > 100000000) {
+        std::printf("usage: %s [maxKeys]   (1000 to 100000000)\n", argv[0]);
+        return 1;
+    }
+
+    std::printf("%-9s %-8s %9s %-7s %12s %7s %7s %7s %9s %10s %9s\n", "structure", "keys", "n", "op", "ops/s",
+        "p50 ns", "p90 ns", "p99 ns", "allocs/op", "heap MB", "rss MB");
+
+    const Distribution distributions[] = { Distribution::UNIFORM, Distribution::SORTED, Distribution::REVERSE, Distribution::ZIPFIAN };
+    bool consistent = true;
+    for (long long count = 1000; count <= maxKeys; count *= 10) {
+        for (Distribution distribution : distributions) {
+            std::mt19937 random(static_cast<unsigned>(count) * 31 + static_cast<unsigned>(distribution));
+            std::vector<int> keys = makeKeys(distribution, static_cast<int>(count), random);
+            std::vector<int> lookups = makeLookups(distribution, keys, random);
+
+            long long avlChecksum = 0, frozenChecksum = 0, fingerChecksum = 0, relaxedChecksum = 0, wavlChecksum = 0, setChecksum = 0, btreeChecksum = 0;
+            std::pair<int, int> avl = run<AVLSubject>(distribution, keys, lookups, avlChecksum);
+            std::pair<int, int> frozen = run<FrozenSubject>(distribution, keys, lookups, frozenChecksum);
+            std::pair<int, int> finger = run<FingerSubject>(distribution, keys, lookups, fingerChecksum);
+            std::pair<int, int> relaxed = run<RelaxedSubject>(distribution, keys, lookups, relaxedChecksum);
+            std::pair<int, int> wavl = run<WAVLSubject>(distribution, keys, lookups, wavlChecksum);
+            std::pair<int, int> set = run<SetSubject>(distribution, keys, lookups, setChecksum);
+            std::pair<int, int> btree = run<BTreeSubject>(distribution, keys, lookups, btreeChecksum);
+            int shared = runShared(distribution, keys, lookups);
+            int binary = runSnapshot(distribution, keys, lookups);
+            int merged = runUnion(distribution, keys);
+            if (shared != set.first || binary != set.second || merged != set.first || avl != set || frozen != set || finger != set || relaxed != set || wavl != set || btree != set || avlChecksum != setChecksum
+                || frozenChecksum != setChecksum || fingerChecksum != setChecksum || relaxedChecksum != setChecksum || wavlChecksum != setChecksum
+                || btreeChecksum != setChecksum) {
+                std::printf("!! results differ for %s n=%lld\n", distributionName(distribution), count);
+                consistent = false;
+            }
+        }
+    }
+    return consistent ? 0 : 1;
+}